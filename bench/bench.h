@@ -0,0 +1,58 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <format>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+// Minimal timing harness shared by the benchmark programs under bench/.
+// Output is a JSON document sorted by benchmark name so that results of two
+// commits can be diffed (or fed to bench/compare.py) line by line.
+namespace bench {
+    struct Result {
+        std::string name;
+        size_t iterations;
+        uint64_t min_ns;
+        uint64_t median_ns;
+        uint64_t mean_ns;
+    };
+
+    inline Result measure(const std::string& name, size_t iterations, const std::function<void()>& fn, bool warmup = true)
+    {
+        if (warmup) fn(); // warm up caches before timing
+        std::vector<uint64_t> samples;
+        samples.reserve(iterations);
+        for (size_t i = 0; i < iterations; i++) {
+            auto start = std::chrono::steady_clock::now();
+            fn();
+            auto end = std::chrono::steady_clock::now();
+            samples.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+        }
+        std::sort(samples.begin(), samples.end());
+        uint64_t total = 0;
+        for (auto s: samples) total += s;
+        return {
+            .name = name,
+            .iterations = iterations,
+            .min_ns = samples.empty()? 0 : samples.front(),
+            .median_ns = samples.empty()? 0 : samples[samples.size() / 2],
+            .mean_ns = samples.empty()? 0 : total / samples.size()
+        };
+    }
+
+    inline void print_json(std::ostream& os, std::vector<Result> results)
+    {
+        std::sort(results.begin(), results.end(), [](const auto& a, const auto& b) { return a.name < b.name; });
+        os << "{\n  \"benchmarks\": [";
+        for (size_t i = 0; i < results.size(); i++) {
+            const auto& r = results[i];
+            os << (i > 0? ",\n" : "\n") << std::format(
+                "    {{\"name\": \"{}\", \"iterations\": {}, \"min_ns\": {}, \"median_ns\": {}, \"mean_ns\": {}}}",
+                r.name, r.iterations, r.min_ns, r.median_ns, r.mean_ns);
+        }
+        os << "\n  ]\n}" << std::endl;
+    }
+}
@@ -0,0 +1,296 @@
+// Offline benchmarks for the work genpack-init does at boot.
+// Everything runs against a generated sandbox: a fake /sys/devices tree, a
+// disk image with a swap signature, stub binaries for modprobe, parted,
+// mkfs and systemctl, and a directory of configure scripts. When a mount
+// namespace can be entered (as root, or through a user namespace) the fake
+// tree and the modprobe stub are bind-mounted over the real ones, and a tmpfs
+// over /run, so that coldplug() itself can be timed. Loop device probing needs real root.
+// Benchmarks whose prerequisites are missing are reported on stderr and left
+// out of the JSON.
+//
+// usage: bench/boot > result.json; bench/compare.py before.json after.json
+#include <sys/ioctl.h>
+#include <sys/mount.h>
+#include <linux/loop.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <filesystem>
+
+#include <pybind11/embed.h>
+
+#include "native/logging.h"
+#include "native/coldplug.h"
+#include "native/disk.h"
+#include "native/subprocess.h"
+#include "native/systemd.h"
+#include "module.h"
+#include "configure.h"
+#include "bench.h"
+
+using namespace pybind11::literals;
+
+static const int num_scripts = 50;
+static const int log_messages = 1000;
+
+static void write_file(const std::filesystem::path& path, const std::string& content)
+{
+    std::filesystem::create_directories(path.parent_path());
+    std::ofstream ofs(path);
+    if (!ofs) throw std::runtime_error(std::format("Failed to create {}", path.string()));
+    ofs << content;
+}
+
+// Deterministic stand-in for /sys/devices: PCI functions with the usual
+// attribute files, some of them carrying virtio/usb children.
+static void generate_sysfs(const std::filesystem::path& devices)
+{
+    static const char* attributes[] = {"uevent", "vendor", "device", "class", "irq", "numa_node", "local_cpus", "enable", "resource", "config"};
+    for (int bus = 0; bus < 4; bus++) {
+        auto root = devices / std::format("pci0000:{:02x}", bus);
+        for (int dev = 0; dev < 32; dev++) {
+            for (int fn = 0; fn < 4; fn++) {
+                auto dir = root / std::format("0000:{:02x}:{:02x}.{}", bus, dev, fn);
+                write_file(dir / "modalias", std::format("pci:v00008086d0000{:02X}{:02X}sv00001AF4sd00001100bc{:02X}sc00i00\n", dev, fn, bus));
+                for (const auto& attr: attributes) write_file(dir / attr, "0\n");
+                write_file(dir / "power" / "control", "auto\n");
+                if (dev % 4 == 0) {
+                    write_file(dir / std::format("virtio{}", dev) / "modalias", std::format("virtio:d{:08X}v00001AF4\n", fn + 1));
+                }
+                if (dev % 8 == 1) {
+                    auto usb = dir / std::format("usb{}", bus * 32 + dev);
+                    write_file(usb / "modalias", "usb:v1D6Bp0002d0606dc09dsc00dp01ic09isc00ip00in00\n");
+                    write_file(usb / "1-0:1.0" / "modalias", "usb:v1D6Bp0002d0606dc09dsc00dp01ic09isc00ip00in00\n");
+                }
+            }
+        }
+    }
+}
+
+static void generate_stubs(const std::filesystem::path& bin)
+{
+    for (const auto& name: {"modprobe", "parted", "mkfs.ext4", "mkswap", "mount", "umount", "systemctl"}) {
+        write_file(bin / name, "#!/bin/sh\nexit 0\n");
+        std::filesystem::permissions(bin / name, std::filesystem::perms::owner_all | std::filesystem::perms::group_exec | std::filesystem::perms::others_exec);
+    }
+}
+
+static void generate_scripts(const std::filesystem::path& dir)
+{
+    for (int i = 0; i < num_scripts; i++) {
+        write_file(dir / std::format("{:02d}-bench.py", i), std::format(
+            "import os, logging\n"
+            "import genpack_init\n"
+            "\n"
+            "def configure(ini):\n"
+            "    value = ini.get(\"_default\", \"foo\", fallback=\"baz\")\n"
+            "    path = genpack_init.rw_path(\"etc\", \"bench-{}\")\n"
+            "    logging.debug(\"%s %s\", path, value)\n", i));
+    }
+}
+
+// 64MiB sparse image carrying a swap signature, enough for blkid to report TYPE/UUID
+static void generate_disk_image(const std::filesystem::path& path)
+{
+    const size_t pagesize = 4096, size = 64 * 1024 * 1024;
+    std::vector<char> header(pagesize, 0);
+    uint32_t version = 1, last_page = size / pagesize - 1;
+    memcpy(header.data() + 1024, &version, sizeof(version));
+    memcpy(header.data() + 1028, &last_page, sizeof(last_page));
+    const unsigned char uuid[16] = {0x6b, 0x1e, 0x2c, 0x56, 0x0f, 0x3a, 0x4d, 0x8e, 0x9b, 0x5f, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66};
+    memcpy(header.data() + 1036, uuid, sizeof(uuid));
+    memcpy(header.data() + pagesize - 10, "SWAPSPACE2", 10);
+    std::ofstream ofs(path, std::ios::binary);
+    ofs.write(header.data(), header.size());
+    ofs.close();
+    std::filesystem::resize_file(path, size);
+}
+
+static bool write_proc(const char* path, const std::string& content)
+{
+    std::ofstream ofs(path);
+    return ofs && (ofs << content) && ofs.flush();
+}
+
+static bool enter_namespace(const std::filesystem::path& sandbox, bool real_root)
+{
+    auto uid = getuid(), gid = getgid();
+    if (unshare(real_root? CLONE_NEWNS : (CLONE_NEWUSER | CLONE_NEWNS)) != 0) {
+        std::cerr << "unshare() failed: " << strerror(errno) << std::endl;
+        return false;
+    }
+    if (!real_root) {
+        if (!write_proc("/proc/self/setgroups", "deny") ||
+            !write_proc("/proc/self/uid_map", std::format("0 {} 1", uid)) ||
+            !write_proc("/proc/self/gid_map", std::format("0 {} 1", gid))) {
+            std::cerr << "Failed to set up user namespace id maps" << std::endl;
+            return false;
+        }
+    }
+    if (mount(nullptr, "/", nullptr, MS_REC | MS_PRIVATE, nullptr) != 0) {
+        std::cerr << "Failed to make / private: " << strerror(errno) << std::endl;
+        return false;
+    }
+    if (mount((sandbox / "sys/devices").c_str(), "/sys/devices", nullptr, MS_BIND | MS_REC, nullptr) != 0 ||
+        mount((sandbox / "bin/modprobe").c_str(), "/sbin/modprobe", nullptr, MS_BIND, nullptr) != 0) {
+        std::cerr << "Failed to bind-mount sandbox: " << strerror(errno) << std::endl;
+        return false;
+    }
+    // coldplug() writes its state and udev rules under /run; keep them off the host's
+    if (mount("tmpfs", "/run", "tmpfs", MS_NOSUID | MS_NODEV, "mode=0755") != 0) {
+        std::cerr << "Failed to mount tmpfs on /run: " << strerror(errno) << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Runs fn with stdout pointed at /dev/null so that native logging doesn't mix with the JSON
+template <typename F>
+static auto without_stdout(F fn)
+{
+    std::cout.flush();
+    int saved = dup(STDOUT_FILENO);
+    int devnull = open("/dev/null", O_WRONLY);
+    dup2(devnull, STDOUT_FILENO);
+    close(devnull);
+    auto rst = fn();
+    std::cout.flush();
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+    return rst;
+}
+
+static void setup_python_logging(const std::filesystem::path& logfile)
+{
+    auto logging = pybind11::module_::import("logging");
+    pybind11::list handlers;
+    handlers.append(logging.attr("FileHandler")(logfile.c_str(), "mode"_a = "w"));
+    logging.attr("basicConfig")("level"_a = logging.attr("INFO"),
+        "format"_a = "%(asctime)s %(levelname)s %(filename)s:%(lineno)d %(message)s",
+        "handlers"_a = handlers,
+        "force"_a = true);
+    logging::set_info([](const std::string& msg){ pybind11::module_::import("logging").attr("info")(msg); });
+    logging::set_debug([](const std::string& msg){ pybind11::module_::import("logging").attr("debug")(msg); });
+    logging::set_warning([](const std::string& msg){ pybind11::module_::import("logging").attr("warning")(msg); });
+    logging::set_error([](const std::string& msg){ pybind11::module_::import("logging").attr("error")(msg); });
+}
+
+static void bench_loop_device(const std::filesystem::path& image, std::vector<bench::Result>& results)
+{
+    int ctl = open("/dev/loop-control", O_RDWR | O_CLOEXEC);
+    int n = ctl >= 0? ioctl(ctl, LOOP_CTL_GET_FREE) : -1;
+    if (ctl >= 0) close(ctl);
+    if (n < 0) {
+        std::cerr << "No free loop device, skipping disk/get_block_device_info" << std::endl;
+        return;
+    }
+    auto loopdev = std::filesystem::path(std::format("/dev/loop{}", n));
+    int loopfd = open(loopdev.c_str(), O_RDWR | O_CLOEXEC);
+    int imgfd = open(image.c_str(), O_RDWR | O_CLOEXEC);
+    if (loopfd >= 0 && imgfd >= 0 && ioctl(loopfd, LOOP_SET_FD, imgfd) == 0) {
+        results.push_back(bench::measure("disk/get_block_device_info", 200, [&]() { get_block_device_info(loopdev); }));
+        results.push_back(bench::measure("disk/get_partition_info_loop", 200, [&]() { get_partition_info(loopdev); }));
+        ioctl(loopfd, LOOP_CLR_FD, 0);
+    } else {
+        std::cerr << "Failed to attach loop device, skipping disk/get_block_device_info" << std::endl;
+    }
+    if (imgfd >= 0) close(imgfd);
+    if (loopfd >= 0) close(loopfd);
+}
+
+static void bench_python(const std::filesystem::path& sandbox, std::vector<bench::Result>& results)
+{
+    pybind11::scoped_interpreter guard{};
+    try {
+        pybind11::module_::import("sys").attr("dont_write_bytecode") = true;
+        setup_python_logging(sandbox / "genpack-init.log");
+        setup_genpack_init_module();
+        auto inifile = load_inifile(sandbox / "system.ini");
+        std::vector<std::filesystem::path> scripts;
+        for (const auto& entry: std::filesystem::directory_iterator(sandbox / "scripts")) scripts.push_back(entry.path());
+        std::sort(scripts.begin(), scripts.end());
+        results.push_back(bench::measure(std::format("scripts/run_{}", num_scripts), 10, [&]() {
+            for (const auto& script: scripts) run_configure_script(script, inifile);
+        }));
+        results.push_back(bench::measure(std::format("logging/python_{}", log_messages), 10, []() {
+            for (int i = 0; i < log_messages; i++) logging::info("benchmark message");
+        }));
+    }
+    catch (const std::exception& e) {
+        // guard must be still alive here because the exception may be thrown from python interpreter
+        std::cerr << e.what() << std::endl;
+    }
+}
+
+int main()
+{
+    char tmpl[] = "/tmp/genpack-init-bench.XXXXXX";
+    if (!mkdtemp(tmpl)) {
+        std::cerr << "mkdtemp() failed: " << strerror(errno) << std::endl;
+        return 1;
+    }
+    const std::filesystem::path sandbox(tmpl);
+    const bool real_root = (geteuid() == 0);
+    std::vector<bench::Result> results;
+
+    try {
+        generate_sysfs(sandbox / "sys/devices");
+        generate_stubs(sandbox / "bin");
+        generate_scripts(sandbox / "scripts");
+        generate_disk_image(sandbox / "disk.img");
+        write_file(sandbox / "system.ini", "foo=bar\n[section]\nhoge=fuga\n");
+        setenv("PATH", std::format("{}:{}", (sandbox / "bin").string(), getenv("PATH")? getenv("PATH") : "/usr/bin:/bin").c_str(), 1);
+
+        auto in_namespace = enter_namespace(sandbox, real_root);
+
+        // coldplug
+        results.push_back(bench::measure("coldplug/scan_modaliases", 20, [&]() { scan_modaliases(sandbox / "sys/devices"); }));
+        if (in_namespace) {
+            // coldplug() only does its work once per process, so a single sample
+            results.push_back(without_stdout([]() { return bench::measure("coldplug/full", 1, []() { coldplug(); }, false); }));
+        } else {
+            std::cerr << "No mount namespace, skipping coldplug/full" << std::endl;
+        }
+
+        // block device probing
+        results.push_back(bench::measure("disk/get_partition_info", 200, [&]() { get_partition_info(sandbox / "disk.img"); }));
+        if (real_root) {
+            bench_loop_device(sandbox / "disk.img", results);
+        } else {
+            std::cerr << "Not root, skipping loop device benchmarks" << std::endl;
+        }
+
+        // swap header, written in-process
+        without_stdout([&]() {
+            results.push_back(bench::measure("disk/mkswap", 100, [&]() { mkswap(sandbox / "disk.img", "swap"); }));
+            return 0;
+        });
+
+        // subprocess helpers, against the stubs in PATH
+        without_stdout([&]() {
+            results.push_back(bench::measure("subprocess/run_subprocess", 100, []() { run_subprocess({"true"}); }));
+            results.push_back(bench::measure("subprocess/mkfs", 100, [&]() { mkfs(sandbox / "disk.img", "ext4", "data"); }));
+            results.push_back(bench::measure("subprocess/parted", 100, [&]() { parted(sandbox / "disk.img", "print"); }));
+            results.push_back(bench::measure("subprocess/enable_systemd_service", 100, []() { enable_systemd_service("bench.service"); }));
+            results.push_back(bench::measure(std::format("logging/native_{}", log_messages), 10, []() {
+                for (int i = 0; i < log_messages; i++) logging::info("benchmark message");
+            }));
+            return 0;
+        });
+
+        bench_python(sandbox, results);
+    }
+    catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        std::filesystem::remove_all(sandbox);
+        return 1;
+    }
+
+    std::filesystem::remove_all(sandbox);
+    bench::print_json(std::cout, results);
+    return 0;
+}
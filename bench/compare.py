@@ -0,0 +1,27 @@
+#!/usr/bin/env python3
+"""Compare two JSON results written by the bench/ programs.
+
+usage: bench/compare.py before.json after.json
+"""
+import json, sys
+
+def load(path):
+    with open(path) as f:
+        return {b["name"]: b for b in json.load(f)["benchmarks"]}
+
+def main(before_path, after_path):
+    before, after = load(before_path), load(after_path)
+    width = max((len(name) for name in before.keys() | after.keys()), default=0)
+    for name in sorted(before.keys() | after.keys()):
+        if name not in before or name not in after:
+            print(f"{name:<{width}}  only in {'after' if name in after else 'before'}")
+            continue
+        b, a = before[name]["median_ns"], after[name]["median_ns"]
+        change = (a - b) * 100.0 / b if b else 0.0
+        print(f"{name:<{width}}  {b:>12} ns -> {a:>12} ns  {change:+7.1f}%")
+
+if __name__ == "__main__":
+    if len(sys.argv) != 3:
+        print(__doc__, file=sys.stderr)
+        sys.exit(1)
+    main(sys.argv[1], sys.argv[2])
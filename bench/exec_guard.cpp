@@ -0,0 +1,143 @@
+// Measures the cost exec_guard adds to dlopen-heavy workloads.
+// Runs the same workloads with the guard detached and attached (in-process,
+// nothing is pinned) and prints the results as JSON. Needs root and BPF LSM.
+//
+// usage: bench/exec_guard [library...]
+// Libraries on a non-overlay filesystem (e.g. under /run/initramfs/ro) take the
+// trusted_devs lookup; libraries on the overlay root take the __upperdentry check.
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dlfcn.h>
+
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <set>
+
+#include <bpf/libbpf.h>
+#include <bpf/bpf.h>
+
+#include "exec_guard.skel.h"
+#include "exec_guard.bpf.h"
+#include "bench.h"
+
+static const size_t iterations = 200;
+static const size_t max_default_libraries = 32;
+
+static std::vector<std::filesystem::path> default_libraries()
+{
+    std::vector<std::filesystem::path> libs;
+    for (const auto& dir: {"/usr/lib64", "/usr/lib"}) {
+        if (!std::filesystem::is_directory(dir)) continue;
+        //else
+        for (const auto& entry: std::filesystem::directory_iterator(dir)) {
+            if (!entry.is_regular_file() || entry.is_symlink()) continue;
+            if (entry.path().filename().string().find(".so") == std::string::npos) continue;
+            //else
+            libs.push_back(entry.path());
+        }
+        if (!libs.empty()) break;
+    }
+    std::sort(libs.begin(), libs.end());
+    if (libs.size() > max_default_libraries) libs.resize(max_default_libraries);
+    return libs;
+}
+
+static void map_exec(const std::vector<std::filesystem::path>& libs)
+{
+    auto pagesize = sysconf(_SC_PAGESIZE);
+    for (const auto& lib: libs) {
+        int fd = open(lib.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) continue;
+        //else
+        auto p = mmap(nullptr, pagesize, PROT_READ | PROT_EXEC, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED) munmap(p, pagesize);
+        close(fd);
+    }
+}
+
+static void dlopen_close(const std::vector<std::filesystem::path>& libs)
+{
+    for (const auto& lib: libs) {
+        auto handle = dlopen(lib.c_str(), RTLD_NOW | RTLD_LOCAL);
+        if (handle) dlclose(handle);
+    }
+}
+
+static void run_workloads(const std::string& prefix, const std::vector<std::filesystem::path>& libs,
+    const std::vector<std::filesystem::path>& dlopenable, std::vector<bench::Result>& results)
+{
+    results.push_back(bench::measure(prefix + "/mmap_exec", iterations, [&]() { map_exec(libs); }));
+    results.push_back(bench::measure(prefix + "/dlopen", iterations, [&]() { dlopen_close(dlopenable); }));
+}
+
+int main(int argc, char* argv[])
+{
+    std::vector<std::filesystem::path> libs(argv + 1, argv + argc);
+    if (libs.empty()) libs = default_libraries();
+    if (libs.empty()) {
+        std::cerr << "No libraries to benchmark." << std::endl;
+        return 1;
+    }
+    // keep libraries that can't be loaded into this process out of the dlopen workload
+    std::vector<std::filesystem::path> dlopenable;
+    for (const auto& lib: libs) {
+        auto handle = dlopen(lib.c_str(), RTLD_NOW | RTLD_LOCAL);
+        if (!handle) continue;
+        dlclose(handle);
+        dlopenable.push_back(lib);
+    }
+
+    std::vector<bench::Result> results;
+    run_workloads("exec_guard/off", libs, dlopenable, results);
+
+    // The guard is system-wide while attached: trust every mounted device so
+    // nothing else on the machine gets denied, and run in audit mode so files
+    // on overlay upper layers are only reported.
+    std::set<uint64_t> devs;
+    std::ifstream ifs("/proc/self/mountinfo");
+    std::string line;
+    while (std::getline(ifs, line)) {
+        unsigned int maj, min;
+        if (sscanf(line.c_str(), "%*s %*s %u:%u", &maj, &min) == 2) devs.insert(EXEC_GUARD_MKDEV(maj, min));
+    }
+    auto skel = exec_guard_bpf__open();
+    if (skel) bpf_map__set_max_entries(skel->maps.trusted_devs, devs.size() + 1);
+    if (skel && exec_guard_bpf__load(skel) != 0) {
+        exec_guard_bpf__destroy(skel);
+        skel = nullptr;
+    }
+    if (!skel) {
+        std::cerr << "Failed to load exec_guard BPF program: " << strerror(errno) << std::endl;
+        return 1;
+    }
+    uint8_t one = 1;
+    for (auto dev: devs) {
+        bpf_map__update_elem(skel->maps.trusted_devs, &dev, sizeof(dev), &one, sizeof(one), BPF_ANY);
+    }
+    uint32_t zero = 0;
+    exec_guard_config config = { .audit_only = 1 };
+    bpf_map__update_elem(skel->maps.config, &zero, sizeof(zero), &config, sizeof(config), BPF_ANY);
+    if (exec_guard_bpf__attach(skel) != 0) {
+        std::cerr << "Failed to attach exec_guard BPF LSM: " << strerror(errno) << std::endl;
+        exec_guard_bpf__destroy(skel);
+        return 1;
+    }
+    run_workloads("exec_guard/on", libs, dlopenable, results);
+
+    auto ncpus = libbpf_num_possible_cpus();
+    std::vector<uint64_t> values(ncpus > 0? ncpus : 1);
+    for (uint32_t key: {EXEC_GUARD_STAT_ALLOW, EXEC_GUARD_STAT_DENY}) {
+        if (bpf_map__lookup_elem(skel->maps.stats, &key, sizeof(key), values.data(), values.size() * sizeof(uint64_t), 0) != 0) continue;
+        uint64_t total = 0;
+        for (auto v: values) total += v;
+        std::cerr << std::format("stat[{}] = {}", key, total) << std::endl;
+    }
+    exec_guard_bpf__destroy(skel);
+
+    bench::print_json(std::cout, results);
+    return 0;
+}
@@ -0,0 +1,124 @@
+#include <pthread.h>
+#include <signal.h>
+
+#include <format>
+#include <optional>
+
+#include <pybind11/embed.h>
+
+#include "native/subprocess.h"
+#include "native/watchdog.h"
+
+#include "budget.h"
+
+static const int timeout_signal = SIGUSR2;
+static pthread_t main_thread;
+
+static std::mutex expired_mutex;
+static std::optional<std::string> expired_message; // set while an expired budget is alive
+
+void setup_time_budgets()
+{
+    main_thread = pthread_self();
+    // Python runs signal handlers in the main thread between bytecodes and when
+    // a blocking call (time.sleep, waitpid, ...) is interrupted, which is
+    // exactly where the exception has to appear.
+    auto handler = pybind11::cpp_function([](pybind11::args) {
+        std::optional<std::string> message;
+        {
+            std::lock_guard lock(expired_mutex);
+            message = expired_message;
+        }
+        if (!message) return;
+        //else
+        auto exc = pybind11::module_::import("genpack_init").attr("ScriptTimeout");
+        PyErr_SetString(exc.ptr(), message->c_str());
+        throw pybind11::error_already_set();
+    });
+    pybind11::module_::import("signal").attr("signal")(timeout_signal, handler);
+}
+
+TimeBudget::TimeBudget(std::chrono::seconds limit, const std::string& name, std::function<void()> last_resort)
+    : limit_(limit), name_(name), last_resort_(last_resort)
+{
+    if (limit_.count() <= 0) return;
+    //else
+    arm(limit_, [this]() { on_expire(); });
+}
+
+TimeBudget::~TimeBudget()
+{
+    std::vector<uint64_t> timers;
+    {
+        std::lock_guard lock(mutex_);
+        stopping_ = true;
+        timers.swap(timers_);
+    }
+    for (auto id: timers) watchdog::disarm(id);
+    if (expired_) {
+        std::lock_guard lock(expired_mutex);
+        expired_message.reset();
+        watchdog::set_interrupted(false);
+    }
+}
+
+void TimeBudget::arm(std::chrono::milliseconds timeout, std::function<void()> on_expire)
+{
+    std::lock_guard lock(mutex_);
+    if (stopping_) return;
+    //else
+    timers_.push_back(watchdog::arm(timeout, on_expire));
+}
+
+// runs on the watchdog thread
+void TimeBudget::on_expire()
+{
+    if (!expired_.exchange(true) && last_resort_) {
+        arm(std::chrono::seconds(10), last_resort_);
+    }
+    {
+        std::lock_guard lock(expired_mutex);
+        expired_message = std::format("{} exceeded its time budget of {}s", name_, limit_.count());
+    }
+    watchdog::set_interrupted(true); // for native loops that the signal below interrupts
+    kill_subprocesses();
+    pthread_kill(main_thread, timeout_signal);
+    arm(std::chrono::seconds(1), [this]() { on_expire(); });
+}
+
+#ifdef TEST
+#include <iostream>
+#include <filesystem>
+#include "native/disk.h"
+#include "module.h"
+
+int main()
+{
+    pybind11::scoped_interpreter guard{};
+    setup_genpack_init_module();
+    setup_time_budgets();
+    for (const auto& code: {"while True: pass", "import time; time.sleep(60)", "import subprocess; subprocess.run(['sleep', '60'])"}) {
+        auto start = std::chrono::steady_clock::now();
+        try {
+            TimeBudget budget(std::chrono::seconds(1), code);
+            pybind11::exec(code);
+            std::cout << "Not interrupted: " << code << std::endl;
+            return 1;
+        }
+        catch (const std::exception& e) {
+            auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+            std::cout << e.what() << " (" << elapsed.count() << "ms)" << std::endl;
+        }
+    }
+    // native code has no bytecode boundary to raise at; it has to give up by itself
+    auto start = std::chrono::steady_clock::now();
+    {
+        TimeBudget budget(std::chrono::seconds(1), "wait_for_devices");
+        wait_for_devices({{ .label = "genpack-init-budget-test" }}, std::chrono::seconds(60));
+    }
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+    std::cout << "wait_for_devices returned after " << elapsed.count() << "ms" << std::endl;
+    if (elapsed > std::chrono::seconds(10)) return 1;
+    return 0;
+}
+#endif
@@ -0,0 +1,34 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Must be called from the main thread before any TimeBudget is created
+void setup_time_budgets();
+
+// Limits the time spent by the Python code running in the main thread while
+// the object is alive. When the budget runs out, child processes are killed
+// and genpack_init.ScriptTimeout is raised in the main thread (again every
+// second, in case the script swallows it). If last_resort is given, it is
+// called from the watchdog thread when the main thread still hasn't given
+// up 10 seconds later.
+class TimeBudget {
+public:
+    TimeBudget(std::chrono::seconds limit, const std::string& name, std::function<void()> last_resort = nullptr);
+    ~TimeBudget();
+    bool expired() const { return expired_; }
+private:
+    void on_expire();
+    void arm(std::chrono::milliseconds timeout, std::function<void()> on_expire);
+
+    std::chrono::seconds limit_;
+    std::string name_;
+    std::function<void()> last_resort_;
+    std::atomic<bool> expired_ = false;
+    std::mutex mutex_;
+    bool stopping_ = false;
+    std::vector<uint64_t> timers_;
+};
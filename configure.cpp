@@ -0,0 +1,89 @@
+#include <iostream>
+#include <fstream>
+#include <filesystem>
+#include <algorithm>
+#include <cctype>
+
+#include <pybind11/embed.h>
+
+#include "native/logging.h"
+
+#include "configure.h"
+
+pybind11::object load_inifile(const std::filesystem::path& path)
+{
+    auto configparser = pybind11::module_::import("configparser").attr("ConfigParser")();
+    std::ifstream ifs(path);
+    if (ifs) {
+        std::string ini_content = "[_default]\n" + std::string(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
+        try {
+            configparser.attr("read_string")(ini_content);
+        }
+        catch (const std::exception& e) {
+            // No use logging here, as logging is not yet configured
+            std::cerr << "Error parsing ini file '" + path.string() + "'. Proceeding with empty configuration." << std::endl;
+        }
+    } else {
+        std::cerr << "No ini file found. Proceeding with empty configuration." << std::endl;
+    }
+    return configparser;
+}
+
+pybind11::object load_configure_script(const std::filesystem::path& script)
+{
+    // Each script gets a module of its own, so that functions kept around for
+    // later (see deferred.cpp) still see their own globals.
+    auto name = "genpack_init_script_" + script.stem().string();
+    std::replace_if(name.begin(), name.end(), [](char c) { return !isalnum((unsigned char)c); }, '_');
+    auto machinery = pybind11::module::import("importlib.machinery");
+    auto sourceFileLoader = machinery.attr("SourceFileLoader")(name, script.c_str());
+    return sourceFileLoader.attr("load_module")();
+}
+
+bool is_deferred_script(pybind11::object _module)
+{
+    return pybind11::getattr(_module, "deferred", pybind11::bool_(false)).cast<bool>();
+}
+
+void run_configure(pybind11::object _module, pybind11::object inifile, const std::string& name)
+{
+    if (!pybind11::hasattr(_module, "configure")) {
+        logging::info("No configure function found in " + name + ". Skipping.");
+        return;
+    }
+    //else
+    auto signature = pybind11::module::import("inspect").attr("signature");
+    auto configure_func = _module.attr("configure");
+    auto parameters = signature(configure_func).attr("parameters").cast<pybind11::dict>();
+    auto arglen = pybind11::len(parameters);
+    if (arglen == 1) {
+        configure_func(inifile);
+    } else if (arglen == 0) {
+        configure_func();
+    } else {
+        throw std::runtime_error("configure function must have 0 or 1 argument.");
+    }
+}
+
+void run_configure_script(const std::filesystem::path& script, pybind11::object inifile)
+{
+    run_configure(load_configure_script(script), inifile, script.string());
+}
+
+#ifdef TEST
+#include "module.h"
+
+int main()
+{
+    pybind11::scoped_interpreter guard{};
+    setup_genpack_init_module();
+    try {
+        run_configure_script("test/mymodule.py", load_inifile("test/test.ini"));
+    }
+    catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
+#endif
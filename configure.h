@@ -0,0 +1,10 @@
+#pragma once
+#include <filesystem>
+#include <pybind11/embed.h>
+
+pybind11::object load_inifile(const std::filesystem::path& path);
+pybind11::object load_configure_script(const std::filesystem::path& script);
+// true if the script set 'deferred = True' at module level
+bool is_deferred_script(pybind11::object _module);
+void run_configure(pybind11::object _module, pybind11::object inifile, const std::string& name);
+void run_configure_script(const std::filesystem::path& script, pybind11::object inifile);
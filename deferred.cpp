@@ -0,0 +1,241 @@
+#include <sys/inotify.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <filesystem>
+#include <format>
+#include <map>
+
+#include <pybind11/embed.h>
+
+#include "native/logging.h"
+#include "native/rootfs.h"
+
+#include "configure.h"
+#include "deferred.h"
+
+static const char* status_dir = "/run/genpack-init";
+static const char* status_file = "deferred.status";
+static const char* unit_name = "genpack-init-deferred.service";
+// how long units ordered after the worker wait for it, in systemd time span syntax
+static const char* wait_timeout = "30min";
+
+static pybind11::list deferred_queue()
+{
+    return pybind11::module_::import("genpack_init").attr("_deferred");
+}
+
+void defer_configure(pybind11::object _module, pybind11::object inifile, const std::filesystem::path& script)
+{
+    auto func = pybind11::cpp_function([_module, inifile, script]() {
+        run_configure(_module, inifile, script.string());
+    });
+    deferred_queue().append(pybind11::make_tuple(script.string(), func, pybind11::tuple(), pybind11::dict()));
+}
+
+static void write_status(const std::map<std::string, std::string>& status)
+{
+    auto dir = rootfs::path(status_dir);
+    std::filesystem::create_directories(dir);
+    // rename() so that readers never see a partially written file
+    auto tmp = dir / (std::string(status_file) + ".tmp");
+    {
+        std::ofstream ofs(tmp);
+        for (const auto& [key, value]: status) ofs << key << "=" << value << std::endl;
+    }
+    std::filesystem::rename(tmp, dir / status_file);
+}
+
+static std::map<std::string, std::string> read_status()
+{
+    std::map<std::string, std::string> status;
+    std::ifstream ifs(rootfs::path(status_dir) / status_file);
+    std::string line;
+    while (std::getline(ifs, line)) {
+        auto pos = line.find('=');
+        if (pos == std::string::npos) continue;
+        status[line.substr(0, pos)] = line.substr(pos + 1);
+    }
+    return status;
+}
+
+static int run_deferred(pybind11::list queue)
+{
+    std::map<std::string, std::string> status = {
+        {"state", "running"},
+        {"pid", std::to_string(getpid())},
+        {"total", std::to_string(pybind11::len(queue))},
+        {"completed", "0"},
+        {"failed", "0"}
+    };
+    write_status(status);
+    int completed = 0, failed = 0;
+    for (const auto& item: queue) {
+        auto entry = item.cast<pybind11::tuple>();
+        auto name = entry[0].cast<std::string>();
+        status["current"] = name;
+        write_status(status);
+        logging::info(std::format("Running deferred {}", name));
+        try {
+            entry[1](*entry[2], **entry[3]);
+        }
+        catch (const std::exception& e) {
+            logging::error(name + ": " + e.what());
+            failed++;
+        }
+        completed++;
+        status["completed"] = std::to_string(completed);
+        status["failed"] = std::to_string(failed);
+    }
+    status.erase("current");
+    status["state"] = "done";
+    write_status(status);
+    logging::info(std::format("Deferred configuration done ({} of {} failed).", failed, completed));
+    return failed;
+}
+
+// Lets units order themselves after the worker with After=genpack-init-deferred.service
+static void write_unit()
+{
+    auto self = std::filesystem::read_symlink("/proc/self/exe");
+    auto dir = rootfs::path("/run/systemd/system");
+    std::filesystem::create_directories(dir / "multi-user.target.wants");
+    std::ofstream ofs(dir / unit_name);
+    ofs << "[Unit]\n"
+        << "Description=Wait for deferred genpack-init configuration\n"
+        << "DefaultDependencies=no\n"
+        << "\n"
+        << "[Service]\n"
+        << "Type=oneshot\n"
+        << "RemainAfterExit=yes\n"
+        << "TimeoutStartSec=" << wait_timeout << "\n"
+        << "ExecStart=" << self.string() << " --wait-deferred\n";
+    ofs.close();
+    std::error_code ec;
+    std::filesystem::create_symlink(std::filesystem::path("..") / unit_name, dir / "multi-user.target.wants" / unit_name, ec);
+}
+
+int start_deferred()
+{
+    auto queue = deferred_queue();
+    if (pybind11::len(queue) == 0) return 0;
+    //else
+    if (rootfs::sandboxed()) {
+        // nothing to hand off to; run everything now so that it gets validated too
+        return run_deferred(queue);
+    }
+    //else
+    try {
+        write_unit();
+    }
+    catch (const std::exception& e) {
+        logging::warning(std::format("Failed to write {}: {}", unit_name, e.what()));
+    }
+    // The child holds off until the parent has published its pid, so that the
+    // "starting" status can't overwrite the child's own progress
+    int sync[2];
+    if (pipe2(sync, O_CLOEXEC) != 0) {
+        logging::error("pipe() failed, running deferred configuration now.");
+        return run_deferred(queue);
+    }
+    //else
+    PyOS_BeforeFork();
+    auto pid = fork();
+    if (pid == 0) {
+        PyOS_AfterFork_Child();
+        close(sync[1]);
+        char c;
+        while (read(sync[0], &c, 1) < 0 && errno == EINTR) {}
+        close(sync[0]);
+        setsid();
+        int failed = 1;
+        try {
+            failed = run_deferred(queue);
+        }
+        catch (const std::exception& e) {
+            logging::error(std::string("Deferred worker failed: ") + e.what());
+        }
+        pybind11::module_::import("logging").attr("shutdown")();
+        _exit(failed > 0? 1 : 0);
+    }
+    //else
+    PyOS_AfterFork_Parent();
+    close(sync[0]);
+    if (pid < 0) {
+        close(sync[1]);
+        logging::error("fork() failed, running deferred configuration now.");
+        return run_deferred(queue);
+    }
+    //else
+    // The status file must exist before init starts, or --wait-deferred would see no work.
+    // The pid lets it notice a worker that died before writing anything itself.
+    try {
+        write_status({{"state", "starting"}, {"pid", std::to_string(pid)}, {"total", std::to_string(pybind11::len(queue))}});
+    }
+    catch (const std::exception& e) {
+        logging::error(std::format("Failed to write deferred status: {}", e.what()));
+    }
+    close(sync[1]);
+    logging::info(std::format("Deferred configuration continues in pid {}.", pid));
+    return 0;
+}
+
+int wait_deferred()
+{
+    auto dir = rootfs::path(status_dir);
+    int fd = inotify_init1(IN_CLOEXEC);
+    if (fd < 0 || inotify_add_watch(fd, dir.c_str(), IN_MOVED_TO | IN_CLOSE_WRITE) < 0) {
+        // no status directory at all means nothing was deferred
+        if (fd >= 0) close(fd);
+        return std::filesystem::exists(dir / status_file)? 1 : 0;
+    }
+    int rst = 0;
+    while (true) {
+        auto status = read_status();
+        if (status.empty()) break;
+        //else
+        if (status["state"] == "done") {
+            rst = status["failed"] == "0"? 0 : 1;
+            break;
+        }
+        //else
+        auto pid = atoi(status["pid"].c_str());
+        if (pid <= 0 || (kill(pid, 0) != 0 && errno == ESRCH)) {
+            logging::error("Deferred worker is gone before finishing.");
+            rst = 1;
+            break;
+        }
+        //else
+        struct pollfd pfd = { .fd = fd, .events = POLLIN };
+        if (poll(&pfd, 1, 1000) > 0) {
+            char buf[4096];
+            (void)read(fd, buf, sizeof(buf)); // drain; the status file is re-read anyway
+        }
+    }
+    close(fd);
+    return rst;
+}
+
+#ifdef TEST
+#include <iostream>
+#include "module.h"
+
+int main()
+{
+    pybind11::scoped_interpreter guard{};
+    setup_genpack_init_module();
+    rootfs::set_root(std::filesystem::temp_directory_path() / "genpack-init-deferred-test");
+    pybind11::exec(R"(
+import genpack_init
+genpack_init.defer(print, "deferred", "call", sep=" ")
+)");
+    auto failed = start_deferred();
+    std::cout << "failed=" << failed << ", state=" << read_status()["state"] << std::endl;
+    std::filesystem::remove_all(rootfs::root());
+    return failed;
+}
+#endif
@@ -0,0 +1,11 @@
+#pragma once
+#include <filesystem>
+#include <pybind11/embed.h>
+
+// Queues a whole configure script to run after init has been started
+void defer_configure(pybind11::object _module, pybind11::object inifile, const std::filesystem::path& script);
+// Runs the deferred queue: inline when sandboxed, otherwise in a detached worker.
+// Returns the number of failures of an inline run.
+int start_deferred();
+// Blocks until the deferred worker has finished (genpack-init --wait-deferred)
+int wait_deferred();
@@ -4,6 +4,8 @@
 #include <bpf/bpf_tracing.h>
 #include <bpf/bpf_core_read.h>
 
+#include "exec_guard.bpf.h"
+
 #define EPERM 1
 #define PROT_EXEC 0x4
 #define OVERLAYFS_SUPER_MAGIC 0x794c7630
@@ -19,33 +21,117 @@ struct ovl_inode {
     struct dentry *__upperdentry;
 } __attribute__((preserve_access_index));
 
+// Policy maps. Sizes are defaults; the loader grows them before load when
+// system.ini asks for more.
 struct {
     __uint(type, BPF_MAP_TYPE_HASH);
-    __uint(max_entries, 16);
+    __uint(max_entries, 64);
     __type(key, __u64);
     __type(value, __u8);
 } trusted_devs SEC(".maps");
 
-static __always_inline int check_file(struct file *file)
+struct {
+    __uint(type, BPF_MAP_TYPE_HASH);
+    __uint(max_entries, 1024);
+    __type(key, struct exec_guard_inode);
+    __type(value, __u8);
+} allowed_inodes SEC(".maps");
+
+// Denial events consumed by userspace (see exec_guard_monitor())
+struct {
+    __uint(type, BPF_MAP_TYPE_RINGBUF);
+    __uint(max_entries, 256 * 1024);
+} events SEC(".maps");
+
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY);
+    __uint(max_entries, 1);
+    __type(key, __u32);
+    __type(value, struct exec_guard_config);
+} config SEC(".maps");
+
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __uint(max_entries, EXEC_GUARD_STAT_MAX);
+    __type(key, __u32);
+    __type(value, __u64);
+} stats SEC(".maps");
+
+static __always_inline void count(__u32 stat)
+{
+    __u64 *value = bpf_map_lookup_elem(&stats, &stat);
+    if (value) (*value)++; // per-CPU slot, no atomics needed
+}
+
+static __always_inline struct exec_guard_config *get_config(void)
+{
+    __u32 zero = 0;
+    return bpf_map_lookup_elem(&config, &zero);
+}
+
+static __always_inline int deny(struct exec_guard_config *cfg, __u32 hook, __u32 reason, struct inode *inode)
+{
+    int audited = cfg && cfg->audit_only;
+    count(EXEC_GUARD_STAT_DENY);
+
+    struct exec_guard_event *e = bpf_ringbuf_reserve(&events, sizeof(*e), 0);
+    if (!e) {
+        count(EXEC_GUARD_STAT_EVENTS_DROPPED);
+        return audited ? 0 : -EPERM;
+    }
+    e->dev = (__u64)BPF_CORE_READ(inode, i_sb, s_dev);
+    e->ino = BPF_CORE_READ(inode, i_ino);
+    e->pid = bpf_get_current_pid_tgid() >> 32;
+    e->hook = hook;
+    e->reason = reason;
+    e->audited = audited;
+    bpf_get_current_comm(e->comm, sizeof(e->comm));
+    bpf_ringbuf_submit(e, 0);
+    return audited ? 0 : -EPERM;
+}
+
+static __always_inline int allow(void)
+{
+    count(EXEC_GUARD_STAT_ALLOW);
+    return 0;
+}
+
+static __always_inline int is_allowed_inode(__u64 dev, __u64 ino)
+{
+    struct exec_guard_inode key = { .dev = dev, .ino = ino };
+    return bpf_map_lookup_elem(&allowed_inodes, &key) != NULL;
+}
+
+static __always_inline int check_file(struct file *file, __u32 hook)
 {
     if (!file) return 0;
 
     struct inode *inode = BPF_CORE_READ(file, f_inode);
     struct super_block *sb = BPF_CORE_READ(inode, i_sb);
-    unsigned long magic = BPF_CORE_READ(sb, s_magic);
 
-    if (magic == OVERLAYFS_SUPER_MAGIC) {
+    if (BPF_CORE_READ(sb, s_magic) == OVERLAYFS_SUPER_MAGIC) {
         // container_of: __builtin_offsetof with preserve_access_index generates
         // a CO-RE relocation resolved against overlay module BTF at load time.
         struct ovl_inode *oi = (struct ovl_inode *)((char *)inode
             - __builtin_offsetof(struct ovl_inode, vfs_inode));
         struct dentry *upper = BPF_CORE_READ(oi, __upperdentry);
-        return upper ? -EPERM : 0;
+        if (!upper) return allow();
+        // Allowed files are keyed on the upper inode itself: the overlay's own
+        // s_dev/i_ino are not what stat() reports on a non-samefs overlay
+        // without xino, and the loader resolves them through the upperdir.
+        struct inode *upper_inode = BPF_CORE_READ(upper, d_inode);
+        if (is_allowed_inode((__u64)BPF_CORE_READ(upper_inode, i_sb, s_dev), BPF_CORE_READ(upper_inode, i_ino))) {
+            return allow();
+        }
+        // Report the upper inode too, so the event matches what allowed_files resolves to
+        return deny(get_config(), hook, EXEC_GUARD_REASON_OVERLAY_UPPER, upper_inode);
     }
 
     __u64 dev = (__u64)BPF_CORE_READ(sb, s_dev);
-    __u8 *found = bpf_map_lookup_elem(&trusted_devs, &dev);
-    return found ? 0 : -EPERM;
+    if (bpf_map_lookup_elem(&trusted_devs, &dev) || is_allowed_inode(dev, BPF_CORE_READ(inode, i_ino))) {
+        return allow();
+    }
+    return deny(get_config(), hook, EXEC_GUARD_REASON_UNTRUSTED_DEV, inode);
 }
 
 SEC("lsm/bprm_check_security")
@@ -60,7 +146,7 @@ int BPF_PROG(exec_guard_check, struct linux_binprm *bprm, int ret)
           magic[2] == 'L' && magic[3] == 'F'))
         return 0;
 
-    return check_file(BPF_CORE_READ(bprm, file));
+    return check_file(bprm->file, EXEC_GUARD_HOOK_BPRM_CHECK);
 }
 
 SEC("lsm/mmap_file")
@@ -69,7 +155,7 @@ int BPF_PROG(mmap_guard, struct file *file, unsigned long reqprot,
 {
     if (ret) return ret;
     if (!(prot & PROT_EXEC)) return 0;
-    return check_file(file);
+    return check_file(file, EXEC_GUARD_HOOK_MMAP_FILE);
 }
 
 char LICENSE[] SEC("license") = "GPL";
@@ -0,0 +1,54 @@
+// SPDX-License-Identifier: GPL-2.0
+// Types shared between exec_guard.bpf.c and its userspace loader.
+#pragma once
+
+#ifndef __VMLINUX_H__
+#include <linux/types.h>
+#endif
+
+#define EXEC_GUARD_COMM_LEN 16
+
+// Device numbers in the maps and events use the kernel's internal encoding
+// (sb->s_dev), which differs from the st_dev userspace gets from stat().
+#define EXEC_GUARD_MKDEV(major, minor) (((__u64)(major) << 20) | (minor))
+#define EXEC_GUARD_MAJOR(dev) ((unsigned int)((dev) >> 20))
+#define EXEC_GUARD_MINOR(dev) ((unsigned int)((dev) & 0xfffff))
+
+enum exec_guard_hook {
+    EXEC_GUARD_HOOK_BPRM_CHECK = 1,
+    EXEC_GUARD_HOOK_MMAP_FILE = 2,
+};
+
+enum exec_guard_reason {
+    EXEC_GUARD_REASON_OVERLAY_UPPER = 1,   // file lives on (or was copied up to) the overlay upper layer
+    EXEC_GUARD_REASON_UNTRUSTED_DEV = 2,   // file lives on a device not listed in trusted_devs
+};
+
+// Key of the allowed_inodes map
+struct exec_guard_inode {
+    __u64 dev;
+    __u64 ino;
+};
+
+// Indices into the per-CPU stats array
+enum exec_guard_stat {
+    EXEC_GUARD_STAT_ALLOW = 0,
+    EXEC_GUARD_STAT_DENY,
+    EXEC_GUARD_STAT_EVENTS_DROPPED,
+    EXEC_GUARD_STAT_MAX
+};
+
+struct exec_guard_event {
+    __u64 dev;      // for EXEC_GUARD_REASON_OVERLAY_UPPER, the upper layer's inode
+    __u64 ino;
+    __u32 pid;
+    __u32 hook;     // enum exec_guard_hook
+    __u32 reason;   // enum exec_guard_reason
+    __u32 audited;  // non-zero if the exec was let through because of audit mode
+    char comm[EXEC_GUARD_COMM_LEN];
+};
+
+// Single entry of the config array
+struct exec_guard_config {
+    __u32 audit_only;   // report denials but do not enforce them
+};
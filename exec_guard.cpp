@@ -1,36 +1,242 @@
 #include <sys/stat.h>
+#include <sys/sysmacros.h>
 #include <sys/mount.h>
+#include <sys/vfs.h>
+#include <linux/magic.h>
+#include <unistd.h>
+#include <cctype>
 #include <cerrno>
 #include <cstring>
 #include <cstdint>
+#include <ctime>
 #include <format>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <map>
+#include <optional>
+#include <tuple>
+#include <vector>
 
 #include <bpf/libbpf.h>
+#include <bpf/bpf.h>
 
 #include "exec_guard.skel.h"
+#include "exec_guard.bpf.h"
 #include "exec_guard.h"
 #include "native/logging.h"
 
 static struct exec_guard_bpf *skel = nullptr;
 
-bool setup_exec_guard(const char* lower_path)
+static const char* pin_dir = "/sys/fs/bpf/exec_guard";
+
+static std::string pin_path(const char* name)
+{
+    return std::format("{}/{}", pin_dir, name);
+}
+
+struct ResolvedPolicy {
+    std::vector<uint64_t> trusted_devs;
+    std::vector<exec_guard_inode> allowed_inodes;
+    bool audit_only;
+};
+
+static uint64_t kernel_dev(dev_t dev)
+{
+    return EXEC_GUARD_MKDEV(major(dev), minor(dev));
+}
+
+// mountinfo escapes whitespace, backslashes and (in super options) commas as \ooo
+static std::string unescape_mountinfo(const std::string& str)
+{
+    std::string rst;
+    for (size_t i = 0; i < str.size(); i++) {
+        if (str[i] == '\\' && i + 3 < str.size() && std::isdigit(str[i + 1])) {
+            rst += (char)std::stoi(str.substr(i + 1, 3), nullptr, 8);
+            i += 3;
+        } else {
+            rst += str[i];
+        }
+    }
+    return rst;
+}
+
+// Where path lives in the upperdir of the overlay mount that contains it.
+// The kernel side keys allowed overlay files on the upper inode, because what
+// stat() reports for an overlay file depends on samefs/xino.
+static std::optional<std::filesystem::path> overlay_upper_path(const std::filesystem::path& path)
+{
+    std::error_code ec;
+    auto canonical = std::filesystem::canonical(path, ec);
+    if (ec) return std::nullopt;
+    //else
+    std::ifstream ifs("/proc/self/mountinfo");
+    std::string line;
+    std::filesystem::path best_mountpoint, best_root;
+    std::optional<std::string> best_upperdir;
+    while (std::getline(ifs, line)) {
+        std::istringstream iss(line);
+        std::string id, parent, majmin, root, mountpoint, field;
+        iss >> id >> parent >> majmin >> root >> mountpoint;
+        while (iss >> field && field != "-") {}
+        std::string fstype, source, options;
+        iss >> fstype >> source >> options;
+        std::filesystem::path mp = unescape_mountinfo(mountpoint);
+        auto rel = canonical.lexically_relative(mp);
+        if (rel.empty() || *rel.begin() == "..") continue;
+        // the innermost mount wins; of equal ones the later, which is stacked on top
+        if (mp.string().size() < best_mountpoint.string().size()) continue;
+        //else
+        best_mountpoint = mp;
+        best_root = unescape_mountinfo(root);
+        best_upperdir = std::nullopt;
+        if (fstype != "overlay") continue;
+        //else
+        std::istringstream opts(options);
+        std::string opt;
+        while (std::getline(opts, opt, ',')) {
+            if (opt.starts_with("upperdir=")) best_upperdir = unescape_mountinfo(opt.substr(9));
+        }
+    }
+    if (!best_upperdir) return std::nullopt;
+    //else
+    auto rel = canonical.lexically_relative(best_mountpoint);
+    auto upper = std::filesystem::path(*best_upperdir) / best_root.relative_path();
+    return rel == "."? upper : upper / rel;
+}
+
+static ResolvedPolicy resolve_policy(const ExecGuardPolicy& policy)
+{
+    ResolvedPolicy resolved { .audit_only = policy.audit_only };
+    for (const auto& path: policy.trusted_mounts) {
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0) {
+            logging::warning(std::format("exec_guard: stat({}) failed: {}", path.string(), strerror(errno)));
+            continue;
+        }
+        auto dev = kernel_dev(st.st_dev);
+        if (std::find(resolved.trusted_devs.begin(), resolved.trusted_devs.end(), dev) == resolved.trusted_devs.end()) {
+            resolved.trusted_devs.push_back(dev);
+        }
+    }
+    for (const auto& path: policy.allowed_files) {
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0) {
+            logging::warning(std::format("exec_guard: stat({}) failed: {}", path.string(), strerror(errno)));
+            continue;
+        }
+        struct statfs fs;
+        if (statfs(path.c_str(), &fs) == 0 && fs.f_type == OVERLAYFS_SUPER_MAGIC) {
+            auto upper = overlay_upper_path(path);
+            if (!upper) {
+                logging::warning(std::format("exec_guard: cannot locate the upper layer of {}", path.string()));
+                continue;
+            }
+            //else
+            if (stat(upper->c_str(), &st) != 0) {
+                // lower-only files are trusted anyway; a copy-up needs a policy reload
+                logging::debug(std::format("exec_guard: {} is not on the upper layer ({})", path.string(), upper->string()));
+                continue;
+            }
+        }
+        resolved.allowed_inodes.push_back({ .dev = kernel_dev(st.st_dev), .ino = st.st_ino });
+    }
+    return resolved;
+}
+
+// Replaces the content of a hash map with keys, inserting before deleting so
+// that a concurrent lookup never sees an entry go missing that stays in the policy.
+template <typename Key>
+static int replace_map_keys(int fd, const std::vector<Key>& keys)
+{
+    std::vector<uint8_t> values(keys.size(), 1);
+    uint32_t count = keys.size();
+    if (count > 0 && bpf_map_update_batch(fd, keys.data(), values.data(), &count, nullptr) != 0) {
+        // batch ops need Linux 5.6+; fall back to one syscall per element
+        for (const auto& key: keys) {
+            uint8_t one = 1;
+            if (bpf_map_update_elem(fd, &key, &one, BPF_ANY) != 0) return -errno;
+        }
+    }
+
+    std::vector<Key> stale;
+    Key key, next;
+    const Key* prev = nullptr;
+    while (bpf_map_get_next_key(fd, prev, &next) == 0) {
+        auto equals = [&next](const Key& k) { return memcmp(&k, &next, sizeof(Key)) == 0; };
+        if (std::find_if(keys.begin(), keys.end(), equals) == keys.end()) stale.push_back(next);
+        key = next;
+        prev = &key;
+    }
+    count = stale.size();
+    if (count > 0 && bpf_map_delete_batch(fd, stale.data(), &count, nullptr) != 0) {
+        for (const auto& k: stale) bpf_map_delete_elem(fd, &k);
+    }
+    return 0;
+}
+
+static bool apply_policy(int trusted_devs_fd, int allowed_inodes_fd, int config_fd, const ResolvedPolicy& policy)
+{
+    int err = replace_map_keys(trusted_devs_fd, policy.trusted_devs);
+    if (err == 0) err = replace_map_keys(allowed_inodes_fd, policy.allowed_inodes);
+    if (err) {
+        logging::error(std::format("exec_guard: failed to update policy maps: {}", strerror(-err)));
+        return false;
+    }
+    uint32_t zero = 0;
+    exec_guard_config config = {};
+    config.audit_only = policy.audit_only;
+    if (bpf_map_update_elem(config_fd, &zero, &config, BPF_ANY) != 0) {
+        logging::error(std::format("exec_guard: failed to update config: {}", strerror(errno)));
+        return false;
+    }
+    return true;
+}
+
+static std::string describe(const ResolvedPolicy& policy)
+{
+    std::string devs;
+    for (auto dev: policy.trusted_devs) {
+        if (!devs.empty()) devs += ",";
+        devs += std::format("{}:{}", EXEC_GUARD_MAJOR(dev), EXEC_GUARD_MINOR(dev));
+    }
+    return std::format("trusted devs={} allowed inodes={} mode={}",
+        devs, policy.allowed_inodes.size(), policy.audit_only? "audit" : "enforce");
+}
+
+bool setup_exec_guard(const ExecGuardPolicy& policy)
 {
-    struct stat st;
-    if (stat(lower_path, &st) != 0) {
-        logging::warning(std::format("exec_guard: stat({}) failed: {}", lower_path, strerror(errno)));
+    auto resolved = resolve_policy(policy);
+    if (resolved.trusted_devs.empty()) {
+        logging::warning("exec_guard: no trusted mount could be resolved");
         return false;
     }
 
-    skel = exec_guard_bpf__open_and_load();
+    skel = exec_guard_bpf__open();
     if (!skel) {
+        logging::warning(std::format("exec_guard: failed to open BPF program (errno={})", errno));
+        return false;
+    }
+    // Leave room for reloads that add entries; the maps can't be resized once loaded
+    auto grow = [](struct bpf_map* map, size_t needed) {
+        if (needed * 2 > bpf_map__max_entries(map)) bpf_map__set_max_entries(map, needed * 2);
+    };
+    grow(skel->maps.trusted_devs, resolved.trusted_devs.size());
+    grow(skel->maps.allowed_inodes, resolved.allowed_inodes.size());
+    if (exec_guard_bpf__load(skel) != 0) {
         // Likely cause: overlay module not loaded or CONFIG_DEBUG_INFO_BTF_MODULES not set
         logging::warning(std::format("exec_guard: failed to load BPF program (errno={})", errno));
+        exec_guard_bpf__destroy(skel);
+        skel = nullptr;
         return false;
     }
 
-    uint64_t dev = static_cast<uint64_t>(st.st_dev);
-    uint8_t one = 1;
-    bpf_map__update_elem(skel->maps.trusted_devs, &dev, sizeof(dev), &one, sizeof(one), BPF_ANY);
+    if (!apply_policy(bpf_map__fd(skel->maps.trusted_devs), bpf_map__fd(skel->maps.allowed_inodes),
+            bpf_map__fd(skel->maps.config), resolved)) {
+        exec_guard_bpf__destroy(skel);
+        skel = nullptr;
+        return false;
+    }
 
     int err = exec_guard_bpf__attach(skel);
     if (err) {
@@ -46,12 +252,308 @@ bool setup_exec_guard(const char* lower_path)
     if (mount("none", "/sys/fs/bpf", "bpf", 0, "") != 0 && errno != EBUSY) {
         logging::warning(std::format("exec_guard: failed to mount bpf fs: {}", strerror(errno)));
     }
-    mkdir("/sys/fs/bpf/exec_guard", 0700);
-    if (bpf_link__pin(skel->links.exec_guard_check, "/sys/fs/bpf/exec_guard/exec_check") ||
-        bpf_link__pin(skel->links.mmap_guard,        "/sys/fs/bpf/exec_guard/mmap_guard")) {
+    mkdir(pin_dir, 0700);
+    if (bpf_link__pin(skel->links.exec_guard_check, pin_path("exec_check").c_str()) ||
+        bpf_link__pin(skel->links.mmap_guard,        pin_path("mmap_guard").c_str())) {
         logging::warning(std::format("exec_guard: failed to pin BPF links ({}); programs will be inactive after exec", strerror(errno)));
     }
+    // Pin the event ring buffer and counters too, so that exec_guard_monitor() can
+    // pick them up after we are gone. Denials that happen before anyone reads stay
+    // queued in the ring buffer.
+    if (bpf_map__pin(skel->maps.events, pin_path("events").c_str()) ||
+        bpf_map__pin(skel->maps.stats,  pin_path("stats").c_str())) {
+        logging::warning(std::format("exec_guard: failed to pin event maps ({}); denials will not be observable", strerror(errno)));
+    }
+    // ...and the policy maps, for reload_exec_guard_policy()
+    if (bpf_map__pin(skel->maps.trusted_devs,   pin_path("trusted_devs").c_str()) ||
+        bpf_map__pin(skel->maps.allowed_inodes, pin_path("allowed_inodes").c_str()) ||
+        bpf_map__pin(skel->maps.config,         pin_path("config").c_str())) {
+        logging::warning(std::format("exec_guard: failed to pin policy maps ({}); policy cannot be reloaded", strerror(errno)));
+    }
+
+    logging::info(std::format("exec_guard: active. {}", describe(resolved)));
+    return true;
+}
+
+bool reload_exec_guard_policy(const ExecGuardPolicy& policy)
+{
+    auto resolved = resolve_policy(policy);
+    if (resolved.trusted_devs.empty()) {
+        logging::error("exec_guard: no trusted mount could be resolved, keeping current policy");
+        return false;
+    }
+
+    int fds[3];
+    const char* names[3] = {"trusted_devs", "allowed_inodes", "config"};
+    for (int i = 0; i < 3; i++) {
+        fds[i] = bpf_obj_get(pin_path(names[i]).c_str());
+        if (fds[i] < 0) {
+            logging::error(std::format("exec_guard: cannot open pinned map {}: {}", names[i], strerror(errno)));
+            for (int j = 0; j < i; j++) close(fds[j]);
+            return false;
+        }
+    }
+    auto rst = apply_policy(fds[0], fds[1], fds[2], resolved);
+    for (auto fd: fds) close(fd);
+    if (rst) logging::info(std::format("exec_guard: policy reloaded. {}", describe(resolved)));
+    return rst;
+}
+
+static const char* hook_name(uint32_t hook)
+{
+    switch (hook) {
+    case EXEC_GUARD_HOOK_BPRM_CHECK: return "exec";
+    case EXEC_GUARD_HOOK_MMAP_FILE: return "mmap";
+    default: return "unknown";
+    }
+}
+
+static const char* reason_name(uint32_t reason)
+{
+    switch (reason) {
+    case EXEC_GUARD_REASON_OVERLAY_UPPER: return "overlay upper layer";
+    case EXEC_GUARD_REASON_UNTRUSTED_DEV: return "untrusted device";
+    default: return "unknown";
+    }
+}
+
+struct MonitorState {
+    struct Entry {
+        time_t last_logged = 0;
+        uint64_t suppressed = 0;
+    };
+    using Key = std::tuple<uint64_t, uint64_t, uint32_t>;
+    // keyed by (dev, ino, hook) so that one misbehaving binary can't flood the log
+    std::map<Key, Entry> entries;
+    unsigned int interval;
+};
+
+// bounds MonitorState::entries; denials of that many distinct files within one interval are already an incident
+static const size_t max_monitor_entries = 4096;
+
+static void log_suppressed(const MonitorState::Key& key, uint64_t suppressed)
+{
+    auto [dev, ino, hook] = key;
+    logging::warning(std::format("exec_guard: {} more denials of {} of dev={}:{} ino={}", suppressed, hook_name(hook),
+        EXEC_GUARD_MAJOR(dev), EXEC_GUARD_MINOR(dev), ino));
+}
+
+// Drops entries whose rate limit window has passed (all of them if force),
+// printing what was suppressed so that no denial goes unreported
+static void evict_entries(MonitorState& state, time_t now, bool force)
+{
+    for (auto it = state.entries.begin(); it != state.entries.end(); ) {
+        if (!force && now - it->second.last_logged < state.interval) {
+            ++it;
+            continue;
+        }
+        //else
+        if (it->second.suppressed > 0) log_suppressed(it->first, it->second.suppressed);
+        it = state.entries.erase(it);
+    }
+}
+
+static int handle_event(void* ctx, void* data, size_t size)
+{
+    if (size < sizeof(exec_guard_event)) return 0;
+    //else
+    auto state = static_cast<MonitorState*>(ctx);
+    auto e = static_cast<const exec_guard_event*>(data);
+    auto now = time(nullptr);
+    MonitorState::Key key {e->dev, e->ino, e->hook};
+    if (!state->entries.contains(key) && state->entries.size() >= max_monitor_entries) {
+        evict_entries(*state, now, false);
+        if (state->entries.size() >= max_monitor_entries) evict_entries(*state, now, true);
+    }
+    auto& entry = state->entries[key];
+    if (entry.last_logged != 0 && now - entry.last_logged < state->interval) {
+        entry.suppressed++;
+        return 0;
+    }
+    //else
+    std::string comm(e->comm, strnlen(e->comm, sizeof(e->comm)));
+    auto msg = std::format("exec_guard: {} {} of dev={}:{} ino={} by pid={} comm={} ({})",
+        e->audited? "would deny" : "denied", hook_name(e->hook),
+        EXEC_GUARD_MAJOR(e->dev), EXEC_GUARD_MINOR(e->dev), e->ino, e->pid, comm, reason_name(e->reason));
+    if (entry.suppressed > 0) {
+        msg += std::format(", {} similar denials suppressed", entry.suppressed);
+    }
+    logging::warning(msg);
+    entry.last_logged = now;
+    entry.suppressed = 0;
+    return 0;
+}
 
-    logging::info(std::format("exec_guard: active. trusted dev=0x{:x}", dev));
+static bool read_stats(int stats_fd, uint64_t (&totals)[EXEC_GUARD_STAT_MAX])
+{
+    auto ncpus = libbpf_num_possible_cpus();
+    if (ncpus <= 0) return false;
+    //else
+    std::vector<uint64_t> values(ncpus);
+    for (uint32_t key = 0; key < EXEC_GUARD_STAT_MAX; key++) {
+        if (bpf_map_lookup_elem(stats_fd, &key, values.data()) != 0) return false;
+        totals[key] = 0;
+        for (auto v: values) totals[key] += v;
+    }
     return true;
 }
+
+int exec_guard_monitor(unsigned int interval)
+{
+    int events_fd = bpf_obj_get(pin_path("events").c_str());
+    if (events_fd < 0) {
+        logging::error(std::format("exec_guard: cannot open pinned event map: {}", strerror(errno)));
+        return 1;
+    }
+    int stats_fd = bpf_obj_get(pin_path("stats").c_str());
+    if (stats_fd < 0) {
+        logging::warning(std::format("exec_guard: cannot open pinned stats map: {}", strerror(errno)));
+    }
+
+    MonitorState state { .interval = interval };
+    auto rb = ring_buffer__new(events_fd, handle_event, &state, nullptr);
+    if (!rb) {
+        logging::error(std::format("exec_guard: failed to create ring buffer consumer: {}", strerror(errno)));
+        close(events_fd);
+        if (stats_fd >= 0) close(stats_fd);
+        return 1;
+    }
+
+    uint64_t prev[EXEC_GUARD_STAT_MAX] = {};
+    if (stats_fd >= 0) read_stats(stats_fd, prev);
+    auto last_report = time(nullptr);
+    int rst = 0;
+    while (true) {
+        int err = ring_buffer__poll(rb, 1000);
+        if (err < 0 && err != -EINTR) {
+            logging::error(std::format("exec_guard: ring buffer poll failed: {}", strerror(-err)));
+            rst = 1;
+            break;
+        }
+        auto now = time(nullptr);
+        if (now - last_report < interval) continue;
+        //else
+        evict_entries(state, now, false);
+        if (stats_fd < 0) {
+            last_report = now;
+            continue;
+        }
+        //else
+        uint64_t cur[EXEC_GUARD_STAT_MAX];
+        if (read_stats(stats_fd, cur)) {
+            logging::info(std::format("exec_guard: last {}s: allow={} deny={} dropped={}", now - last_report,
+                cur[EXEC_GUARD_STAT_ALLOW] - prev[EXEC_GUARD_STAT_ALLOW],
+                cur[EXEC_GUARD_STAT_DENY] - prev[EXEC_GUARD_STAT_DENY],
+                cur[EXEC_GUARD_STAT_EVENTS_DROPPED] - prev[EXEC_GUARD_STAT_EVENTS_DROPPED]));
+            std::copy(std::begin(cur), std::end(cur), std::begin(prev));
+        }
+        last_report = now;
+    }
+
+    ring_buffer__free(rb);
+    close(events_fd);
+    if (stats_fd >= 0) close(stats_fd);
+    return rst;
+}
+
+#ifdef TEST
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <iostream>
+
+// Maps the file PROT_EXEC and returns 0 or the errno the guard answered with
+static int map_exec(const std::filesystem::path& path)
+{
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return errno;
+    //else
+    auto pagesize = sysconf(_SC_PAGESIZE);
+    auto p = mmap(nullptr, pagesize, PROT_READ | PROT_EXEC, MAP_PRIVATE, fd, 0);
+    int rst = p == MAP_FAILED? errno : 0;
+    if (p != MAP_FAILED) munmap(p, pagesize);
+    close(fd);
+    return rst;
+}
+
+static bool write_file(const std::filesystem::path& path)
+{
+    std::ofstream ofs(path);
+    ofs << std::string(4096, '\0');
+    return (bool)ofs;
+}
+
+// Needs root and BPF LSM. Builds a non-samefs overlay with xino off (lower and
+// upper on separate tmpfs mounts), which is where stat() on the overlay and the
+// upper inode disagree, then checks the verdicts of files on either layer.
+int main()
+{
+    char tmpl[] = "/tmp/exec_guard.XXXXXX";
+    if (!mkdtemp(tmpl)) return 1;
+    //else
+    std::filesystem::path dir(tmpl);
+    auto lower = dir / "lower", rw = dir / "rw", merged = dir / "merged";
+    for (const auto& d: {lower, rw, merged}) std::filesystem::create_directory(d);
+    if (mount("tmpfs", lower.c_str(), "tmpfs", 0, "") != 0 || mount("tmpfs", rw.c_str(), "tmpfs", 0, "") != 0) {
+        std::cout << "Skipped: cannot mount tmpfs (" << strerror(errno) << ")" << std::endl;
+        umount(lower.c_str());
+        std::filesystem::remove_all(dir);
+        return 0;
+    }
+    std::filesystem::create_directory(rw / "upper");
+    std::filesystem::create_directory(rw / "work");
+    write_file(lower / "lower");
+    auto options = std::format("lowerdir={},upperdir={},workdir={},xino=off", lower.string(), (rw / "upper").string(), (rw / "work").string());
+    int rst = 1;
+    if (mount("overlay", merged.c_str(), "overlay", 0, options.c_str()) != 0) {
+        std::cout << "Skipped: cannot mount overlay (" << strerror(errno) << ")" << std::endl;
+        rst = 0;
+    } else {
+        write_file(merged / "allowed");
+        write_file(merged / "denied");
+        ExecGuardPolicy policy { .trusted_mounts = {}, .allowed_files = {merged / "allowed"} };
+        auto resolved = resolve_policy(policy);
+        // the guard is global while attached: keep everything but overlay upper layers running
+        std::ifstream ifs("/proc/self/mountinfo");
+        std::string line;
+        while (std::getline(ifs, line)) {
+            unsigned int maj, min;
+            if (sscanf(line.c_str(), "%*s %*s %u:%u", &maj, &min) != 2) continue;
+            //else
+            auto dev = EXEC_GUARD_MKDEV(maj, min);
+            if (std::find(resolved.trusted_devs.begin(), resolved.trusted_devs.end(), dev) == resolved.trusted_devs.end()) {
+                resolved.trusted_devs.push_back(dev);
+            }
+        }
+        skel = exec_guard_bpf__open();
+        if (skel) bpf_map__set_max_entries(skel->maps.trusted_devs, resolved.trusted_devs.size() + 1);
+        if (skel && exec_guard_bpf__load(skel) != 0) {
+            exec_guard_bpf__destroy(skel);
+            skel = nullptr;
+        }
+        if (resolved.allowed_inodes.size() != 1) {
+            std::cout << "allowed file on the upper layer was not resolved" << std::endl;
+        } else if (!skel) {
+            std::cout << "Skipped: cannot load BPF program (" << strerror(errno) << ")" << std::endl;
+            rst = 0;
+        } else if (!apply_policy(bpf_map__fd(skel->maps.trusted_devs), bpf_map__fd(skel->maps.allowed_inodes),
+                bpf_map__fd(skel->maps.config), resolved) || exec_guard_bpf__attach(skel) != 0) {
+            std::cout << "Skipped: cannot attach BPF LSM (" << strerror(errno) << ")" << std::endl;
+            rst = 0;
+        } else {
+            rst = 0;
+            const std::pair<const char*, int> cases[] = {{"allowed", 0}, {"denied", EPERM}, {"lower", 0}};
+            for (auto [name, expected]: cases) {
+                auto err = map_exec(merged / name);
+                std::cout << name << ": " << (err? strerror(err) : "mapped") << std::endl;
+                if (err != expected) rst = 1;
+            }
+        }
+        if (skel) exec_guard_bpf__destroy(skel);
+        umount(merged.c_str());
+    }
+    umount(rw.c_str());
+    umount(lower.c_str());
+    std::filesystem::remove_all(dir);
+    return rst;
+}
+#endif
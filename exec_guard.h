@@ -1,2 +1,16 @@
 #pragma once
-bool setup_exec_guard(const char* lower_path = "/run/initramfs/ro");
+#include <filesystem>
+#include <vector>
+
+struct ExecGuardPolicy {
+    // executables and libraries on these mounts are trusted as a whole
+    std::vector<std::filesystem::path> trusted_mounts = {"/run/initramfs/ro"};
+    // individual files trusted wherever they live; resolved to inodes at (re)load time
+    std::vector<std::filesystem::path> allowed_files;
+    // log denials but let them through
+    bool audit_only = false;
+};
+
+bool setup_exec_guard(const ExecGuardPolicy& policy = {});
+bool reload_exec_guard_policy(const ExecGuardPolicy& policy);
+int exec_guard_monitor(unsigned int interval = 10);
@@ -2,18 +2,26 @@
 #include <sys/mount.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <iostream>
 #include <fstream>
 #include <filesystem>
 #include <functional>
+#include <sstream>
 #include <format>
 
 #include <pybind11/embed.h>
 #include <argparse/argparse.hpp>
 
 #include "native/logging.h"
+#include "native/rootfs.h"
+#include "native/readahead.h"
+#include "native/tuning.h"
 
 #include "module.h"
+#include "configure.h"
+#include "deferred.h"
+#include "budget.h"
 #include "repl.h"
 
 #ifdef WITH_EXEC_GUARD
@@ -22,23 +30,112 @@
 
 using namespace pybind11::literals;
 
-auto load_inifile(const std::filesystem::path& path)
+std::filesystem::path system_ini_path()
 {
-    auto configparser = pybind11::module_::import("configparser").attr("ConfigParser")();
-    std::ifstream ifs(path);
-    if (ifs) {
-        std::string ini_content = "[_default]\n" + std::string(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
+    const auto inifile_dir = rootfs::path(
+        std::filesystem::is_directory(rootfs::path("/run/initramfs/boot"))? 
+            "/run/initramfs/boot":"/run/initramfs/rw"
+    );
+    return inifile_dir / "system.ini";
+}
+
+#ifdef WITH_EXEC_GUARD
+// [exec_guard]
+// trusted_mounts = /run/initramfs/extra   (in addition to /run/initramfs/ro)
+// allow = /usr/local/bin/vetted-tool      (whitespace separated, may span lines)
+// mode = audit                            (default: enforce)
+ExecGuardPolicy load_exec_guard_policy(pybind11::object inifile)
+{
+    auto get_list = [&inifile](const char* key) {
+        std::vector<std::filesystem::path> paths;
+        std::istringstream iss(inifile.attr("get")("exec_guard", key, "fallback"_a = "").cast<std::string>());
+        std::string path;
+        while (iss >> path) paths.push_back(path);
+        return paths;
+    };
+    ExecGuardPolicy policy;
+    for (const auto& path: get_list("trusted_mounts")) {
+        policy.trusted_mounts.push_back(path);
+    }
+    policy.allowed_files = get_list("allow");
+    auto mode = inifile.attr("get")("exec_guard", "mode", "fallback"_a = "enforce").cast<std::string>();
+    if (mode != "enforce" && mode != "audit") {
+        logging::warning(std::format("exec_guard: unknown mode '{}', using enforce", mode));
+    }
+    policy.audit_only = (mode == "audit");
+    return policy;
+}
+#endif
+
+// [sysctl]
+// vm.swappiness = 10
+// [tuning]
+// governor = performance
+// irq_affinity = yes
+// rps = yes
+// xps = yes
+TuningProfile load_tuning_profile(pybind11::object inifile)
+{
+    TuningProfile profile;
+    if (inifile.attr("has_section")("sysctl").cast<bool>()) {
+        // raw: values such as kernel.core_pattern contain '%', which interpolation rejects
+        for (const auto& item: inifile.attr("items")("sysctl", "raw"_a = true)) {
+            auto kv = item.cast<std::pair<std::string, std::string>>();
+            profile.sysctl.push_back(kv);
+        }
+    }
+    auto governor = inifile.attr("get")("tuning", "governor", "raw"_a = true, "fallback"_a = "").cast<std::string>();
+    if (!governor.empty()) profile.governor = governor;
+    profile.irq_affinity = inifile.attr("getboolean")("tuning", "irq_affinity", "raw"_a = true, "fallback"_a = false).cast<bool>();
+    profile.rps = inifile.attr("getboolean")("tuning", "rps", "raw"_a = true, "fallback"_a = false).cast<bool>();
+    profile.xps = inifile.attr("getboolean")("tuning", "xps", "raw"_a = true, "fallback"_a = false).cast<bool>();
+    return profile;
+}
+
+[[noreturn]] static void exec_init()
+{
+    // exec /sbin/init or /usr/bin/init
+    execl("/sbin/init", "/sbin/init", nullptr);
+    //else
+    execl("/usr/bin/init", "/usr/bin/init", nullptr);
+    //else there is nothing we can do
+    reboot(RB_HALT_SYSTEM);
+    _exit(1);
+}
+
+// Returns the number of failed scripts. scripts[done] onwards were not run
+// because the configure phase as a whole ran out of time.
+static int run_configure_scripts(const std::vector<std::filesystem::path>& scripts, pybind11::object inifile,
+    int script_timeout, int configure_timeout, size_t& done)
+{
+    // If the main thread can't even be interrupted (stuck in native code
+    // holding the GIL), boot anyway rather than hanging forever.
+    std::function<void()> last_resort;
+    if (!rootfs::sandboxed()) last_resort = []() {
+        std::cerr << "genpack-init: configure phase could not be interrupted, starting init now" << std::endl;
+        exec_init();
+    };
+    TimeBudget total(std::chrono::seconds(configure_timeout), "configure phase", last_resort);
+    int failed = 0;
+    for (done = 0; done < scripts.size() && !total.expired(); done++) {
+        const auto& script = scripts[done];
         try {
-            configparser.attr("read_string")(ini_content);
+            TimeBudget budget(std::chrono::seconds(script_timeout), script.string());
+            auto _module = load_configure_script(script);
+            if (is_deferred_script(_module)) {
+                logging::info(std::format("{} deferred.", script.string()));
+                defer_configure(_module, inifile, script);
+                continue;
+            }
+            //else
+            run_configure(_module, inifile, script.string());
         }
         catch (const std::exception& e) {
-            // No use logging here, as logging is not yet configured
-            std::cerr << "Error parsing ini file '" + path.string() + "'. Proceeding with empty configuration." << std::endl;
+            logging::error(script.string() + ": " + e.what());
+            failed++;
         }
-    } else {
-        std::cerr << "No ini file found. Proceeding with empty configuration." << std::endl;
     }
-    return configparser;
+    return failed;
 }
 
 int run_as_init()
@@ -47,17 +144,14 @@ int run_as_init()
     // disable writing of .pyc files
     sys.attr("dont_write_bytecode") = true;
 
-    const auto inifile_dir = std::filesystem::path(
-        std::filesystem::is_directory("/run/initramfs/boot")? 
-            "/run/initramfs/boot":"/run/initramfs/rw"
-    );
-    auto inifile = load_inifile(inifile_dir / "system.ini");
+    auto inifile = load_inifile(system_ini_path());
     auto debug = inifile.attr("getboolean")("_default", "debug", "fallback"_a = false).cast<bool>();
 
     // setup logging
     auto logging = pybind11::module_::import("logging");
     pybind11::list handlers;
-    handlers.append(logging.attr("FileHandler")("/var/log/genpack-init.log", "mode"_a = "w"));
+    // a dry run leaves the image untouched, so it only logs to stderr
+    if (!rootfs::sandboxed()) handlers.append(logging.attr("FileHandler")("/var/log/genpack-init.log", "mode"_a = "w"));
     handlers.append(logging.attr("StreamHandler")());
     logging.attr("basicConfig")("level"_a = logging.attr(debug? "DEBUG":"INFO"), 
         "format"_a = "%(asctime)s %(levelname)s %(filename)s:%(lineno)d %(message)s",
@@ -72,9 +166,13 @@ int run_as_init()
         logging::debug("Debug mode enabled");
     }
 
+    if (rootfs::sandboxed()) {
+        logging::info(std::format("Configuring {}{}", rootfs::root().string(), rootfs::dry_run()? " (dry run)" : ""));
+    }
+
 #ifdef WITH_EXEC_GUARD
-    if (inifile.attr("getboolean")("_default", "exec_guard", "fallback"_a = true).cast<bool>()) {
-        if (!setup_exec_guard()) {
+    if (!rootfs::sandboxed() && inifile.attr("getboolean")("_default", "exec_guard", "fallback"_a = true).cast<bool>()) {
+        if (!setup_exec_guard(load_exec_guard_policy(inifile))) {
             logging::warning("exec_guard: setup failed, continuing without exec protection");
         }
         if (mount("/usr", "/usr", nullptr, MS_BIND, nullptr) == 0 &&
@@ -89,41 +187,54 @@ int run_as_init()
     setup_genpack_init_module();
 
     // load and run every .py file in the inifile_dir
-    if (!std::filesystem::is_directory("/usr/lib/genpack-init")) {
-        logging::error("Directory /usr/lib/genpack-init not found.");
+    const auto scripts_dir = rootfs::path("/usr/lib/genpack-init");
+    if (!std::filesystem::is_directory(scripts_dir)) {
+        logging::error(std::format("Directory {} not found.", scripts_dir.string()));
         return 1;
     }
     //else
 
-    auto machinery = pybind11::module::import("importlib.machinery");
-    auto signature = pybind11::module::import("inspect").attr("signature");
-    for (const auto& entry: std::filesystem::directory_iterator("/usr/lib/genpack-init")) {
+    // readahead = auto (prefetch from the recorded or shipped list) | record | no
+    auto readahead = inifile.attr("get")("_default", "readahead", "fallback"_a = "auto").cast<std::string>();
+    if (readahead != "auto" && readahead != "record" && readahead != "no") {
+        logging::warning(std::format("Unknown readahead mode '{}', using auto", readahead));
+        readahead = "auto";
+    }
+    if (readahead == "auto" && !rootfs::sandboxed()) start_readahead();
+
+    // time budgets in seconds, 0 = unlimited
+    auto script_timeout = inifile.attr("getint")("_default", "script_timeout", "fallback"_a = 0).cast<int>();
+    auto configure_timeout = inifile.attr("getint")("_default", "configure_timeout", "fallback"_a = 0).cast<int>();
+    setup_time_budgets();
+
+    std::vector<std::filesystem::path> scripts;
+    for (const auto& entry: std::filesystem::directory_iterator(scripts_dir)) {
         if (entry.path().extension() != ".py") continue;
         //else
-        try {
-            auto sourceFileLoader = machinery.attr("SourceFileLoader")("mymodule", entry.path().c_str());
-            auto _module = sourceFileLoader.attr("load_module")();
-            if (!pybind11::hasattr(_module, "configure")) {
-                logging::info("No configure function found in " + entry.path().string() + ". Skipping.");
-                continue;
-            }
-            //else
-            auto configure_func = _module.attr("configure");
-            auto parameters = signature(configure_func).attr("parameters").cast<pybind11::dict>();
-            auto arglen = pybind11::len(parameters);
-            if (arglen == 1) {
-                configure_func(inifile);
-            } else if (arglen == 0) {
-                configure_func();
-            } else {
-                throw std::runtime_error("configure function must have 0 or 1 argument.");
-            }
-        }
-        catch (const std::exception& e) {
-            logging::error(entry.path().string() + ": " + e.what());
-        }
+        scripts.push_back(entry.path());
     }
-    return 0;
+    size_t done = 0;
+    int failed = run_configure_scripts(scripts, inifile, script_timeout, configure_timeout, done);
+    for (auto i = done; i < scripts.size(); i++) {
+        logging::error(std::format("Configure phase exceeded {}s, skipped {}", configure_timeout, scripts[i].string()));
+        failed++;
+    }
+
+    // after the scripts, so that they can't undo it, and before any service starts
+    try {
+        failed += apply_tuning(load_tuning_profile(inifile));
+    }
+    catch (const std::exception& e) {
+        logging::error(std::format("Tuning failed: {}", e.what()));
+        failed++;
+    }
+    failed += start_deferred();
+    finish_readahead();
+    if (readahead == "record") {
+        auto seconds = inifile.attr("getint")("_default", "readahead_record_time", "fallback"_a = 60).cast<int>();
+        start_readahead_recorder(std::max(seconds, 1));
+    }
+    return failed > 0? 1 : 0;
 }
 
 #if 0
@@ -175,16 +286,86 @@ int main(int argc, char* argv[])
                 std::cerr << e.what() << std::endl;
             }
         }
-        // exec /sbin/init or /usr/bin/init
-        execl("/sbin/init", "/sbin/init", nullptr);
-        //else
-        execl("/usr/bin/init", "/usr/bin/init", nullptr);
-        //else there is nothing we can do
-        reboot(RB_HALT_SYSTEM);
+        exec_init();
     }
     // else 
+    argparse::ArgumentParser program(argv[0]);
+#ifdef WITH_EXEC_GUARD
+    program.add_argument("--exec-guard-monitor")
+        .help("log exec_guard denial events (to stderr) and decision counters (to stdout)")
+        .default_value(false).implicit_value(true);
+    program.add_argument("--exec-guard-reload")
+        .help("reload exec_guard policy from system.ini into the pinned maps")
+        .default_value(false).implicit_value(true);
+#endif
+    program.add_argument("--wait-deferred")
+        .help("wait until the deferred configure phase has finished")
+        .default_value(false).implicit_value(true);
+    program.add_argument("--root")
+        .help("run the configure scripts against the system image unpacked at this directory (implies --dry-run)")
+        .default_value(std::string("/"));
+    program.add_argument("--dry-run")
+        .help("record mount/mkfs/parted/systemctl and other commands instead of running them")
+        .default_value(false).implicit_value(true);
+    program.add_argument("--actions")
+        .help("write recorded actions to this file (JSON array per line) instead of stdout");
+    try {
+        program.parse_args(argc, argv);
+    }
+    catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl << program;
+        return 1;
+    }
+
+#ifdef WITH_EXEC_GUARD
+    if (program.get<bool>("--exec-guard-monitor")) {
+        return exec_guard_monitor();
+    }
+#endif
+    if (program.get<bool>("--wait-deferred")) {
+        return wait_deferred();
+    }
+
     pybind11::scoped_interpreter guard{};
 
+#ifdef WITH_EXEC_GUARD
+    if (program.get<bool>("--exec-guard-reload")) {
+        try {
+            return reload_exec_guard_policy(load_exec_guard_policy(load_inifile(system_ini_path())))? 0 : 1;
+        }
+        catch (const std::exception& e) {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+    }
+#endif
+
+    auto root = program.get<std::string>("--root");
+    auto dry_run = program.get<bool>("--dry-run");
+    if (root != "/" && !dry_run) {
+        // commands, mounts and device changes would hit the host rather than the image
+        std::cerr << "--root implies --dry-run" << std::endl;
+        dry_run = true;
+    }
+    if (dry_run) {
+        rootfs::set_root(root);
+        rootfs::set_dry_run(dry_run);
+        int rst = 1;
+        try {
+            rst = run_as_init();
+        }
+        catch (const std::exception& e) {
+            std::cerr << e.what() << std::endl;
+        }
+        if (auto actions_file = program.present("--actions")) {
+            std::ofstream ofs(*actions_file);
+            rootfs::write_actions(ofs);
+        } else if (dry_run) {
+            rootfs::write_actions(std::cout);
+        }
+        return rst;
+    }
+
     try {
         setup_genpack_init_module();
         std::string red_begin = "\033[31m";
@@ -26,9 +26,30 @@ def parted():
 def mkfs():
     pass
 
+def wait_for_device(uuid=None, label=None, path=None, timeout=10.0):
+    return None
+
+def wait_for_devices(devices, timeout=10.0):
+    return [None] * len(devices)
+
+def grow_partition_and_filesystem(partition):
+    logging.info(f"Growing {partition}")
+    return 0
+
+def unlock_volumes(volumes, jobs=0):
+    return [{"name": v["name"], "ok": True, "error": None, "seconds": 0.0} for v in volumes]
+
 def mkswap():
     pass
 
+def swapon(device, priority=-1, discard=False):
+    logging.info(f"Enabling swap on {device}")
+    return 0
+
+def setup_zram_swap(algorithm=None, fraction=0.5, max_size=None, writeback_device=None, priority=100):
+    logging.info(f"Setting up zram swap algorithm={algorithm} fraction={fraction}")
+    return None
+
 def _create_posix_path(base, *args) -> pathlib.PosixPath:
     new_args = [base]
     if len(args) > 0:
@@ -54,6 +75,35 @@ def chown():
 def chmod():
     pass
 
+def provision_accounts(groups=[], users=[]):
+    for group in groups:
+        logging.info(f"Provisioning group {group['name']}")
+    for user in users:
+        logging.info(f"Provisioning user {user['name']}")
+    return 0
+
+def copy_tree(src, dst, jobs=0):
+    logging.info(f"Copying {src} to {dst}")
+    return 0
+
+def get_platform_info():
+    return {
+        "architecture": "x86_64", "model": "", "cpu_model": "", "cpu_flags": set(),
+        "cpus": [{"id": 0, "package": 0, "core": 0, "node": 0}],
+        "cores": 1, "packages": 1, "threads_per_core": 1,
+        "numa_nodes": [{"id": 0, "cpus": [0], "memory": 1024 * 1024 * 1024}],
+        "memory": 1024 * 1024 * 1024,
+        "dmi": {"sys_vendor": "", "product_name": "", "product_version": "",
+                "board_vendor": "", "board_name": "", "bios_vendor": "", "bios_version": ""}
+    }
+
+def configure_network(links):
+    logging.info(f"Configuring network {links}")
+    return 0
+
+def wait_for_carrier(interfaces, timeout=10.0):
+    return []
+
 def is_raspberry_pi():
     return False
 
@@ -63,8 +113,22 @@ def is_qemu():
 def read_qemu_firmware_config():
     pass
 
+def apply_tuning(sysctl=None, governor=None, irq_affinity=False, rps=False, xps=False):
+    logging.info(f"Applying tuning sysctl={sysctl} governor={governor} irq_affinity={irq_affinity} rps={rps} xps={xps}")
+    return 0
+
 def enable_systemd_service(service):
     logging.info(f"Enabling systemd service {service}")
 
 def disable_systemd_service(service):
     logging.info(f"Disabling systemd service {service}")
+
+def is_dry_run():
+    return False
+
+def defer(func, *args, **kwargs):
+    logging.info(f"Deferring {func.__qualname__}")
+    func(*args, **kwargs)
+
+class ScriptTimeout(BaseException):
+    pass
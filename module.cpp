@@ -5,11 +5,21 @@
 #include <pybind11/stl/filesystem.h>
 
 #include "native/logging.h"
+#include "native/accounts.h"
 #include "native/coldplug.h"
+#ifdef WITH_CRYPTSETUP
+#include "native/crypt.h"
+#endif
+#include "native/copy.h"
 #include "native/disk.h"
 #include "native/filesystem.h"
+#include "native/network.h"
+#include "native/partition.h"
 #include "native/platform.h"
+#include "native/swap.h"
 #include "native/systemd.h"
+#include "native/tuning.h"
+#include "native/rootfs.h"
 #include "native/formatter.h"
 
 #include "repl.h"
@@ -32,6 +42,18 @@ static auto create_posix_path(const std::filesystem::path& root, const pybind11:
     return pybind11::module_::import("pathlib").attr("PosixPath")(*newargs);
 }
 
+static pybind11::object found_device_to_dict(const std::optional<FoundDevice>& found)
+{
+    if (!found) return pybind11::none();
+    //else
+    pybind11::dict d;
+    d["name"] = found->name;
+    d["uuid"] = found->info.uuid;
+    d["label"] = found->info.label;
+    d["type"] = found->info.type;
+    return d;
+}
+
 void setup_genpack_init_module()
 {
     auto modules = pybind11::module_::import("sys").attr("modules");
@@ -70,17 +92,145 @@ void setup_genpack_init_module()
         d["type"] = info->type;
         return d;
     }, "path"_a);
+    dynamic_mod.def("wait_for_device", [](const std::optional<std::string>& uuid, const std::optional<std::string>& label,
+            const std::optional<std::filesystem::path>& path, double timeout) {
+        auto found = wait_for_devices({DeviceMatch { uuid, label, path }}, std::chrono::milliseconds((int64_t)(timeout * 1000)));
+        return found_device_to_dict(found[0]);
+    }, pybind11::kw_only(), "uuid"_a = pybind11::none(), "label"_a = pybind11::none(), "path"_a = pybind11::none(), "timeout"_a = 10.0);
+    // wait_for_devices([{"uuid": "..."}, {"label": "data"}], timeout=30)
+    dynamic_mod.def("wait_for_devices", [](const std::vector<pybind11::dict>& specs, double timeout) {
+        std::vector<DeviceMatch> matches;
+        for (const auto& spec: specs) {
+            DeviceMatch match;
+            if (spec.contains("uuid") && !spec["uuid"].is_none()) match.uuid = spec["uuid"].cast<std::string>();
+            if (spec.contains("label") && !spec["label"].is_none()) match.label = spec["label"].cast<std::string>();
+            if (spec.contains("path") && !spec["path"].is_none()) match.path = spec["path"].cast<std::filesystem::path>();
+            matches.push_back(match);
+        }
+        pybind11::list result;
+        for (const auto& found: wait_for_devices(matches, std::chrono::milliseconds((int64_t)(timeout * 1000)))) {
+            result.append(found_device_to_dict(found));
+        }
+        return result;
+    }, "devices"_a, "timeout"_a = 10.0);
+#ifdef WITH_CRYPTSETUP
+    // unlock_volumes([{"device": "/dev/vdb", "name": "data", "key_fw_cfg": "opt/genpack/luks-key"},
+    //     {"device": "/dev/vdc", "name": "logs", "key_file": "keys/logs.key", "discard": True}])
+    dynamic_mod.def("unlock_volumes", [](const std::vector<pybind11::dict>& specs, unsigned int jobs) {
+        std::vector<CryptVolume> volumes;
+        for (const auto& spec: specs) {
+            CryptVolume volume;
+            volume.device = spec["device"].cast<std::filesystem::path>();
+            volume.name = spec["name"].cast<std::string>();
+            if (spec.contains("key_fw_cfg") && !spec["key_fw_cfg"].is_none()) volume.key_fw_cfg = spec["key_fw_cfg"].cast<std::string>();
+            if (spec.contains("key_file") && !spec["key_file"].is_none()) volume.key_file = spec["key_file"].cast<std::filesystem::path>();
+            if (spec.contains("discard")) volume.discard = spec["discard"].cast<bool>();
+            if (spec.contains("readonly")) volume.readonly = spec["readonly"].cast<bool>();
+            volumes.push_back(volume);
+        }
+        pybind11::list results;
+        for (const auto& result: unlock_volumes(volumes, jobs)) {
+            results.append(pybind11::dict("name"_a = result.name, "ok"_a = result.ok,
+                "error"_a = result.error.empty()? pybind11::none() : pybind11::str(result.error),
+                "seconds"_a = result.elapsed.count() / 1000.0));
+        }
+        return results;
+    }, "volumes"_a, pybind11::kw_only(), "jobs"_a = 0);
+#endif
     dynamic_mod.def("parted", parted, "disk"_a, "command"_a);
     dynamic_mod.def("mkfs", mkfs, "device"_a, "fstype"_a, "label"_a = pybind11::none());
+    dynamic_mod.def("grow_partition_and_filesystem", grow_partition_and_filesystem, "partition"_a);
     dynamic_mod.def("mkswap", mkswap, "device"_a, "label"_a = pybind11::none());
+    dynamic_mod.def("swapon", activate_swap, "device"_a, pybind11::kw_only(), "priority"_a = -1, "discard"_a = false);
+    dynamic_mod.def("setup_zram_swap", [](const std::optional<std::string>& algorithm, double fraction,
+            const std::optional<uint64_t>& max_size, const std::optional<std::filesystem::path>& writeback_device, int priority) {
+        ZramConfig config;
+        config.algorithm = algorithm;
+        config.memory_fraction = fraction;
+        config.max_size = max_size;
+        config.writeback_device = writeback_device;
+        config.priority = priority;
+        return setup_zram_swap(config);
+    }, pybind11::kw_only(), "algorithm"_a = pybind11::none(), "fraction"_a = 0.5, "max_size"_a = pybind11::none(),
+        "writeback_device"_a = pybind11::none(), "priority"_a = 100);
     dynamic_mod.def("mount", mount, "device"_a, "mountpoint"_a, pybind11::kw_only(), "fstype"_a = pybind11::none(), "options"_a = pybind11::none());
     dynamic_mod.def("umount", umount, "mountpoint"_a);
 
+    // network functions
+    // configure_network([{"interface": "eth0", "mtu": 9000, "addresses": ["192.168.0.2/24"],
+    //     "routes": [{"destination": "default", "gateway": "192.168.0.1"}]}])
+    dynamic_mod.def("configure_network", [](const std::vector<pybind11::dict>& links) {
+        std::vector<LinkConfig> configs;
+        for (const auto& link: links) {
+            LinkConfig config;
+            config.interface = link["interface"].cast<std::string>();
+            config.up = link.contains("up")? link["up"].cast<bool>() : true;
+            if (link.contains("mtu") && !link["mtu"].is_none()) config.mtu = link["mtu"].cast<uint32_t>();
+            if (link.contains("addresses")) config.addresses = link["addresses"].cast<std::vector<std::string>>();
+            if (link.contains("routes")) {
+                for (const auto& _route: link["routes"]) {
+                    auto route = _route.cast<pybind11::dict>();
+                    NetworkRoute r;
+                    if (route.contains("destination")) r.destination = route["destination"].cast<std::string>();
+                    if (route.contains("gateway") && !route["gateway"].is_none()) r.gateway = route["gateway"].cast<std::string>();
+                    if (route.contains("metric") && !route["metric"].is_none()) r.metric = route["metric"].cast<uint32_t>();
+                    config.routes.push_back(r);
+                }
+            }
+            configs.push_back(config);
+        }
+        return configure_network(configs);
+    }, "links"_a);
+    dynamic_mod.def("wait_for_carrier", [](const std::vector<std::string>& interfaces, double timeout) {
+        return wait_for_carrier(interfaces, std::chrono::milliseconds((int64_t)(timeout * 1000)));
+    }, "interfaces"_a, "timeout"_a = 10.0);
+
     // platform functions
+    dynamic_mod.def("get_platform_info", []() {
+        const auto& info = get_platform_info();
+        pybind11::list cpus;
+        for (const auto& cpu: info.cpus) {
+            cpus.append(pybind11::dict("id"_a = cpu.id, "package"_a = cpu.package, "core"_a = cpu.core, "node"_a = cpu.node));
+        }
+        pybind11::list numa_nodes;
+        for (const auto& node: info.numa_nodes) {
+            numa_nodes.append(pybind11::dict("id"_a = node.id, "cpus"_a = node.cpus, "memory"_a = node.memory));
+        }
+        pybind11::dict d;
+        d["architecture"] = info.architecture;
+        d["model"] = info.model;
+        d["cpu_model"] = info.cpu_model;
+        d["cpu_flags"] = info.cpu_flags;
+        d["cpus"] = cpus;
+        d["cores"] = info.cores;
+        d["packages"] = info.packages;
+        d["threads_per_core"] = info.threads_per_core;
+        d["numa_nodes"] = numa_nodes;
+        d["memory"] = info.memory;
+        d["dmi"] = pybind11::dict(
+            "sys_vendor"_a = info.dmi.sys_vendor, "product_name"_a = info.dmi.product_name,
+            "product_version"_a = info.dmi.product_version, "board_vendor"_a = info.dmi.board_vendor,
+            "board_name"_a = info.dmi.board_name, "bios_vendor"_a = info.dmi.bios_vendor,
+            "bios_version"_a = info.dmi.bios_version);
+        return d;
+    });
     dynamic_mod.def("is_raspberry_pi", is_raspberry_pi);
     dynamic_mod.def("is_qemu", is_qemu);
     dynamic_mod.def("read_qemu_firmware_config", read_qemu_firmware_config, "name"_a);
     
+    // tuning functions
+    dynamic_mod.def("apply_tuning", [](const std::optional<std::map<std::string, std::string>>& sysctl,
+            const std::optional<std::string>& governor, bool irq_affinity, bool rps, bool xps) {
+        TuningProfile profile;
+        if (sysctl) profile.sysctl.assign(sysctl->begin(), sysctl->end());
+        profile.governor = governor;
+        profile.irq_affinity = irq_affinity;
+        profile.rps = rps;
+        profile.xps = xps;
+        return apply_tuning(profile);
+    }, pybind11::kw_only(), "sysctl"_a = pybind11::none(), "governor"_a = pybind11::none(),
+        "irq_affinity"_a = false, "rps"_a = false, "xps"_a = false);
+
     // systemd functions
     dynamic_mod.def("enable_systemd_service", enable_systemd_service, "name"_a);
     dynamic_mod.def("disable_systemd_service", disable_systemd_service, "name"_a);
@@ -110,22 +260,76 @@ void setup_genpack_init_module()
         return chmod(mode, paths_, recursive);
     }, "mode"_a, pybind11::kw_only(), "recursive"_a = false);
 
+    // provision_accounts(groups=[{"name": "docker", "system": True}],
+    //     users=[{"name": "user", "uid": 1000, "groups": ["wheel", "docker"], "ssh_keys": ["ssh-ed25519 ..."]}])
+    dynamic_mod.def("provision_accounts", [](const std::vector<pybind11::dict>& _groups, const std::vector<pybind11::dict>& _users) {
+        auto get = [](const pybind11::dict& d, const char* key) -> std::optional<pybind11::object> {
+            if (!d.contains(key) || d[key].is_none()) return std::nullopt;
+            //else
+            return pybind11::reinterpret_borrow<pybind11::object>(d[key]);
+        };
+        std::vector<GroupSpec> groups;
+        for (const auto& g: _groups) {
+            GroupSpec spec;
+            spec.name = g["name"].cast<std::string>();
+            if (auto v = get(g, "gid")) spec.gid = v->cast<gid_t>();
+            if (auto v = get(g, "system")) spec.system = v->cast<bool>();
+            if (auto v = get(g, "members")) spec.members = v->cast<std::vector<std::string>>();
+            groups.push_back(spec);
+        }
+        std::vector<UserSpec> users;
+        for (const auto& u: _users) {
+            UserSpec spec;
+            spec.name = u["name"].cast<std::string>();
+            if (auto v = get(u, "uid")) spec.uid = v->cast<uid_t>();
+            if (auto v = get(u, "group")) spec.group = v->cast<std::string>();
+            if (auto v = get(u, "groups")) spec.groups = v->cast<std::vector<std::string>>();
+            if (auto v = get(u, "home")) spec.home = v->cast<std::string>();
+            if (auto v = get(u, "shell")) spec.shell = v->cast<std::string>();
+            if (auto v = get(u, "gecos")) spec.gecos = v->cast<std::string>();
+            if (auto v = get(u, "password")) spec.password = v->cast<std::string>();
+            if (auto v = get(u, "ssh_keys")) spec.ssh_keys = v->cast<std::vector<std::string>>();
+            if (auto v = get(u, "system")) spec.system = v->cast<bool>();
+            if (auto v = get(u, "create_home")) spec.create_home = v->cast<bool>();
+            users.push_back(spec);
+        }
+        return provision_accounts(groups, users);
+    }, pybind11::kw_only(), "groups"_a = std::vector<pybind11::dict>(), "users"_a = std::vector<pybind11::dict>());
+
+    // e.g. copy_tree(ro_path("var/lib/foo"), rw_path("var/lib/foo"))
+    dynamic_mod.def("copy_tree", copy_tree, "src"_a, "dst"_a, pybind11::kw_only(), "jobs"_a = 0);
+
+    dynamic_mod.def("is_dry_run", rootfs::dry_run);
+
+    // raised into a script that exceeded its time budget (see budget.cpp).
+    // Derived from BaseException so that 'except Exception' doesn't swallow it.
+    dynamic_mod.attr("ScriptTimeout") = pybind11::reinterpret_steal<pybind11::object>(
+        PyErr_NewException("genpack_init.ScriptTimeout", PyExc_BaseException, nullptr));
+
+    // deferred work, run after init has been started (see deferred.cpp)
+    dynamic_mod.attr("_deferred") = pybind11::list();
+    dynamic_mod.def("defer", [](pybind11::function func, pybind11::args args, pybind11::kwargs kwargs) {
+        auto name = pybind11::getattr(func, "__qualname__", pybind11::repr(func));
+        pybind11::module_::import("genpack_init").attr("_deferred").cast<pybind11::list>()
+            .append(pybind11::make_tuple(name, func, args, kwargs));
+    }, "func"_a);
+
     auto os = pybind11::module_::import("os");
 
     dynamic_mod.def("root_path", [](pybind11::args args) {
-        return create_posix_path("/", args);
+        return create_posix_path(rootfs::root(), args);
     });
 
     dynamic_mod.def("boot_path", [](pybind11::args args) {
-        return create_posix_path("/run/initramfs/boot", args);
+        return create_posix_path(rootfs::path("/run/initramfs/boot"), args);
     });
 
     dynamic_mod.def("ro_path", [](pybind11::args args) {
-        return create_posix_path("/run/initramfs/ro", args);
+        return create_posix_path(rootfs::path("/run/initramfs/ro"), args);
     });
 
     dynamic_mod.def("rw_path", [](pybind11::args args) {
-        return create_posix_path("/run/initramfs/rw", args);
+        return create_posix_path(rootfs::path("/run/initramfs/rw"), args);
     });    
 }
 
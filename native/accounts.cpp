@@ -0,0 +1,554 @@
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <set>
+#include <sstream>
+
+#include "accounts.h"
+#include "logging.h"
+#include "rootfs.h"
+#include "formatter.h"
+
+namespace {
+
+using Entry = std::vector<std::string>;
+
+// One of the colon separated account databases, kept in file order
+struct Database {
+    std::filesystem::path path;
+    size_t fields;
+    mode_t default_mode;
+    bool exists = false;
+    bool dirty = false;
+    std::vector<Entry> entries;     // comments and blank lines are kept as single-field entries
+
+    Entry* find(const std::string& name) {
+        for (auto& entry: entries) {
+            if (entry.size() > 1 && entry[0] == name) return &entry;
+        }
+        return nullptr;
+    }
+    Entry& add(Entry entry) {
+        entry.resize(fields);
+        entries.push_back(std::move(entry));
+        dirty = true;
+        return entries.back();
+    }
+};
+
+Database load(const char* path, size_t fields, mode_t default_mode)
+{
+    Database db { rootfs::path(path), fields, default_mode };
+    std::ifstream ifs(db.path);
+    db.exists = (bool)ifs;
+    std::string line;
+    while (std::getline(ifs, line)) {
+        Entry entry;
+        if (line.empty() || line[0] == '#') {
+            entry.push_back(line);
+        } else {
+            std::istringstream iss(line);
+            std::string field;
+            while (std::getline(iss, field, ':')) entry.push_back(field);
+            if (line.back() == ':') entry.push_back("");
+            if (entry.size() < fields) entry.resize(fields);
+        }
+        db.entries.push_back(std::move(entry));
+    }
+    return db;
+}
+
+// Writes to a temporary file with the original owner and mode, then renames it into place
+bool save(const Database& db)
+{
+    if (!db.dirty) return true;
+    //else
+    if (rootfs::dry_run()) {
+        rootfs::record({"write", db.path.string()});
+        return true;
+    }
+    //else
+    std::string content;
+    for (const auto& entry: db.entries) {
+        for (size_t i = 0; i < entry.size(); i++) {
+            if (i > 0) content += ':';
+            content += entry[i];
+        }
+        content += '\n';
+    }
+    struct stat st;
+    bool existed = stat(db.path.c_str(), &st) == 0;
+    auto tmp = db.path;
+    tmp += "+";
+    int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | O_NOFOLLOW, 0600);
+    if (fd < 0) {
+        logging::error(std::format("open({}) failed: {}", tmp, strerror(errno)));
+        return false;
+    }
+    //else
+    bool ok = fchmod(fd, existed? st.st_mode & 07777 : db.default_mode) == 0
+        && (!existed || fchown(fd, st.st_uid, st.st_gid) == 0)
+        && write(fd, content.data(), content.size()) == (ssize_t)content.size()
+        && fsync(fd) == 0;
+    auto saved_errno = errno;
+    close(fd);
+    if (!ok || rename(tmp.c_str(), db.path.c_str()) < 0) {
+        logging::error(std::format("Failed to write {}: {}", db.path, strerror(ok? errno : saved_errno)));
+        unlink(tmp.c_str());
+        return false;
+    }
+    //else
+    return true;
+}
+
+bool is_number(const std::string& str)
+{
+    return !str.empty() && std::all_of(str.begin(), str.end(), [](char c) { return c >= '0' && c <= '9'; });
+}
+
+std::optional<unsigned int> parse_id(const std::string& str)
+{
+    if (!is_number(str)) return std::nullopt;
+    //else
+    try {
+        return std::stoul(str);
+    }
+    catch (const std::exception&) {
+        return std::nullopt;
+    }
+}
+
+std::set<unsigned int> used_ids(const Database& db)
+{
+    std::set<unsigned int> ids;
+    for (const auto& entry: db.entries) {
+        if (entry.size() < 3) continue;
+        //else
+        if (auto id = parse_id(entry[2])) ids.insert(*id);
+    }
+    return ids;
+}
+
+// like useradd/groupadd: system ids downwards from 999, others upwards from 1000
+std::optional<unsigned int> allocate_id(const std::set<unsigned int>& used, bool system)
+{
+    if (system) {
+        for (unsigned int id = 999; id >= 101; id--) {
+            if (!used.contains(id)) return id;
+        }
+    } else {
+        for (unsigned int id = 1000; id < 60000; id++) {
+            if (!used.contains(id)) return id;
+        }
+    }
+    return std::nullopt;
+}
+
+void add_to_list(std::string& list, const std::string& name)
+{
+    std::istringstream iss(list);
+    std::string member;
+    while (std::getline(iss, member, ',')) {
+        if (member == name) return;
+    }
+    if (!list.empty()) list += ',';
+    list += name;
+}
+
+// name to id caches for chown()/chgrp(), filled from the databases on first use
+std::optional<std::map<std::string, uid_t>> uid_cache;
+std::optional<std::map<std::string, gid_t>> gid_cache;
+
+template <typename T> std::map<std::string, T> build_cache(const Database& db)
+{
+    std::map<std::string, T> cache;
+    for (const auto& entry: db.entries) {
+        if (entry.size() < 3) continue;
+        //else
+        if (auto id = parse_id(entry[2])) cache.emplace(entry[0], *id);
+    }
+    return cache;
+}
+
+// A miss reloads the database: a configure script may have added the account since the cache was built
+template <typename T> std::optional<T> lookup_id(std::optional<std::map<std::string, T>>& cache,
+    const char* path, size_t fields, const std::string& name)
+{
+    if (auto id = parse_id(name)) return id;
+    //else
+    bool fresh = !cache;
+    if (fresh) cache = build_cache<T>(load(path, fields, 0644));
+    auto it = cache->find(name);
+    if (it == cache->end() && !fresh) {
+        cache = build_cache<T>(load(path, fields, 0644));
+        it = cache->find(name);
+    }
+    if (it == cache->end()) return std::nullopt;
+    //else
+    return it->second;
+}
+
+// The home directory belongs to the user, who could have planted symlinks
+// there to make root write (or chown) elsewhere: everything below goes through
+// fds opened with O_NOFOLLOW, and the file is replaced with renameat().
+bool write_authorized_keys(const std::filesystem::path& home, uid_t uid, gid_t gid, const std::vector<std::string>& keys)
+{
+    auto ssh_dir = rootfs::path(home) / ".ssh";
+    auto authorized_keys = ssh_dir / "authorized_keys";
+    if (rootfs::dry_run()) {
+        rootfs::record({"write", authorized_keys.string()});
+        return true;
+    }
+    //else
+    auto fail = [](const std::filesystem::path& path, const char* what) {
+        logging::error(std::format("{}: {} failed: {}", path, what, strerror(errno)));
+        return false;
+    };
+    int home_fd = open(rootfs::path(home).c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (home_fd < 0) return fail(rootfs::path(home), "open");
+    //else
+    std::shared_ptr<void> home_closer(nullptr, [home_fd](void*) { close(home_fd); });
+    bool created = mkdirat(home_fd, ".ssh", 0700) == 0;
+    if (!created && errno != EEXIST) return fail(ssh_dir, "mkdir");
+    //else
+    int dir_fd = openat(home_fd, ".ssh", O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (dir_fd < 0) return fail(ssh_dir, "open");
+    //else
+    std::shared_ptr<void> dir_closer(nullptr, [dir_fd](void*) { close(dir_fd); });
+    if (created && (fchown(dir_fd, uid, gid) < 0 || fchmod(dir_fd, 0700) < 0)) return fail(ssh_dir, "fchown/fchmod");
+
+    std::vector<std::string> lines;
+    int fd = openat(dir_fd, "authorized_keys", O_RDONLY | O_NOFOLLOW | O_NONBLOCK | O_CLOEXEC);
+    if (fd >= 0) {
+        struct stat st;
+        std::string content;
+        char buf[4096];
+        ssize_t len = 0;
+        if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+            while ((len = read(fd, buf, sizeof(buf))) > 0) content.append(buf, len);
+        }
+        close(fd);
+        if (len < 0) return fail(authorized_keys, "read");
+        //else
+        std::istringstream iss(content);
+        std::string line;
+        while (std::getline(iss, line)) lines.push_back(line);
+    } else if (errno != ENOENT) {
+        return fail(authorized_keys, "open");
+    }
+    bool changed = false;
+    for (const auto& key: keys) {
+        if (std::find(lines.begin(), lines.end(), key) != lines.end()) continue;
+        //else
+        lines.push_back(key);
+        changed = true;
+    }
+    if (!changed) return true;
+    //else
+    std::string content;
+    for (const auto& line: lines) content += line + '\n';
+    const char* tmp = "authorized_keys+";
+    unlinkat(dir_fd, tmp, 0);   // left over from an interrupted run
+    fd = openat(dir_fd, tmp, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0600);
+    if (fd < 0) return fail(ssh_dir / tmp, "open");
+    //else
+    bool ok = fchown(fd, uid, gid) == 0 && fchmod(fd, 0600) == 0
+        && write(fd, content.data(), content.size()) == (ssize_t)content.size()
+        && fsync(fd) == 0;
+    auto saved_errno = errno;
+    close(fd);
+    if (!ok || renameat(dir_fd, tmp, dir_fd, "authorized_keys") < 0) {
+        if (!ok) errno = saved_errno;
+        fail(authorized_keys, "write");
+        unlinkat(dir_fd, tmp, 0);
+        return false;
+    }
+    //else
+    return true;
+}
+
+bool create_home(const std::filesystem::path& home, uid_t uid, gid_t gid)
+{
+    auto path = rootfs::path(home);
+    struct stat st;
+    if (lstat(path.c_str(), &st) == 0) return true;
+    //else
+    if (rootfs::dry_run()) {
+        rootfs::record({"mkdir", home.string()});
+        return true;
+    }
+    //else
+    std::error_code ec;
+    std::filesystem::create_directories(path.parent_path(), ec);
+    // chown through an fd of what mkdir created, never through a path that may have been swapped for a symlink
+    int fd = -1;
+    if (mkdir(path.c_str(), 0700) < 0
+            || (fd = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC)) < 0
+            || fchown(fd, uid, gid) < 0) {
+        logging::error(std::format("Failed to create home directory {}: {}", path, strerror(errno)));
+        if (fd >= 0) close(fd);
+        return false;
+    }
+    //else
+    close(fd);
+    return true;
+}
+
+} // namespace
+
+int provision_accounts(const std::vector<GroupSpec>& groups, const std::vector<UserSpec>& users)
+{
+    auto passwd = load("/etc/passwd", 7, 0644);
+    auto shadow = load("/etc/shadow", 9, 0600);
+    auto group = load("/etc/group", 4, 0644);
+    auto gshadow = load("/etc/gshadow", 4, 0600);
+    auto uids = used_ids(passwd);
+    auto gids = used_ids(group);
+    int failed = 0;
+
+    auto ensure_group = [&](const std::string& name, std::optional<gid_t> gid, bool system) -> std::optional<gid_t> {
+        if (auto entry = group.find(name)) {
+            auto existing = parse_id((*entry)[2]);
+            if (gid && existing != gid) {
+                logging::error(std::format("Group {} exists with gid {}, not {}", name, (*entry)[2], *gid));
+                return std::nullopt;
+            }
+            //else
+            return existing;
+        }
+        //else
+        if (gid && gids.contains(*gid)) {
+            logging::error(std::format("Cannot create group {}: gid {} is in use", name, *gid));
+            return std::nullopt;
+        }
+        //else
+        if (!gid) gid = allocate_id(gids, system);
+        if (!gid) {
+            logging::error(std::format("Cannot create group {}: no free gid", name));
+            return std::nullopt;
+        }
+        //else
+        gids.insert(*gid);
+        group.add({name, "x", std::to_string(*gid), ""});
+        if (gshadow.exists) gshadow.add({name, "!", "", ""});
+        logging::info(std::format("Group {} created (gid {})", name, *gid));
+        return gid;
+    };
+    auto add_member = [&](const std::string& name, const std::string& user) {
+        auto entry = group.find(name);
+        if (!entry) return false;
+        //else
+        auto before = (*entry)[3];
+        add_to_list((*entry)[3], user);
+        if ((*entry)[3] == before) return true;
+        //else
+        group.dirty = true;
+        if (auto gentry = gshadow.find(name)) {
+            add_to_list((*gentry)[3], user);
+            gshadow.dirty = true;
+        }
+        logging::info(std::format("User {} added to group {}", user, name));
+        return true;
+    };
+
+    for (const auto& spec: groups) {
+        if (!ensure_group(spec.name, spec.gid, spec.system)) {
+            failed++;
+            continue;
+        }
+        //else
+        for (const auto& member: spec.members) add_member(spec.name, member);
+    }
+
+    struct Home { std::filesystem::path path; uid_t uid; gid_t gid; bool create; const std::vector<std::string>* keys; };
+    std::vector<Home> homes;
+    auto today = std::to_string(time(nullptr) / 86400);
+    for (const auto& spec: users) {
+        auto entry = passwd.find(spec.name);
+        std::optional<uid_t> uid;
+        if (entry) {
+            uid = parse_id((*entry)[2]);
+            if (spec.uid && uid != spec.uid) {
+                logging::error(std::format("User {} exists with uid {}, not {}", spec.name, (*entry)[2], *spec.uid));
+                failed++;
+                continue;
+            }
+        } else if (spec.uid) {
+            if (uids.contains(*spec.uid)) {
+                logging::error(std::format("Cannot create user {}: uid {} is in use", spec.name, *spec.uid));
+                failed++;
+                continue;
+            }
+            //else
+            uid = spec.uid;
+        } else {
+            uid = allocate_id(uids, spec.system);
+        }
+        if (!uid) {
+            logging::error(std::format("Cannot create user {}: no usable uid", spec.name));
+            failed++;
+            continue;
+        }
+        //else
+        std::optional<gid_t> gid;
+        if (spec.group) {
+            auto gentry = group.find(*spec.group);
+            if (gentry) gid = parse_id((*gentry)[2]);
+            if (!gid) logging::error(std::format("User {}: group {} does not exist", spec.name, *spec.group));
+        } else if (auto gentry = group.find(spec.name)) {
+            gid = parse_id((*gentry)[2]);
+        } else if (entry) {
+            gid = parse_id((*entry)[3]);   // existing user without a group of its own; leave it alone
+        } else {
+            // user private group, with gid = uid where possible
+            gid = ensure_group(spec.name, gids.contains(*uid)? std::nullopt : std::optional<gid_t>(*uid), spec.system);
+        }
+        if (!gid) {
+            failed++;
+            continue;
+        }
+        //else
+        auto home = spec.home.value_or(entry? (*entry)[5] : spec.system? "/" : "/home/" + spec.name);
+        if (entry) {
+            Entry updated = *entry;
+            if (spec.group) updated[3] = std::to_string(*gid);
+            if (spec.gecos) updated[4] = *spec.gecos;
+            if (spec.home) updated[5] = *spec.home;
+            if (spec.shell) updated[6] = *spec.shell;
+            if (updated != *entry) {
+                *entry = updated;
+                passwd.dirty = true;
+                logging::info(std::format("User {} updated", spec.name));
+            }
+            auto sentry = shadow.find(spec.name);
+            if (spec.password && sentry && (*sentry)[1] != *spec.password) {
+                (*sentry)[1] = *spec.password;
+                (*sentry)[2] = today;
+                shadow.dirty = true;
+            } else if (!sentry) {
+                shadow.add({spec.name, spec.password.value_or("!"), today, "0", "99999", "7", "", "", ""});
+            }
+        } else {
+            uids.insert(*uid);
+            passwd.add({spec.name, "x", std::to_string(*uid), std::to_string(*gid), spec.gecos.value_or(""), home,
+                spec.shell.value_or(spec.system? "/sbin/nologin" : "/bin/bash")});
+            shadow.add({spec.name, spec.password.value_or("!"), today, "0", "99999", "7", "", "", ""});
+            logging::info(std::format("User {} created (uid {}, gid {})", spec.name, *uid, *gid));
+        }
+        for (const auto& name: spec.groups) {
+            if (!add_member(name, spec.name)) {
+                logging::error(std::format("User {}: group {} does not exist", spec.name, name));
+                failed++;
+            }
+        }
+        homes.push_back({home, *uid, *gid, spec.create_home && home != "/", &spec.ssh_keys});
+    }
+
+    // groups first, so that no user ever refers to a group that isn't there
+    bool saved = save(group) && save(gshadow) && save(passwd) && save(shadow);
+    if (!saved) return failed + 1;
+    //else
+    uid_cache = build_cache<uid_t>(passwd);
+    gid_cache = build_cache<gid_t>(group);
+
+    for (const auto& home: homes) {
+        if (home.create && !create_home(home.path, home.uid, home.gid)) {
+            failed++;
+            continue;
+        }
+        //else
+        if (!home.keys->empty() && !write_authorized_keys(home.path, home.uid, home.gid, *home.keys)) failed++;
+    }
+    return failed;
+}
+
+std::optional<uid_t> lookup_uid(const std::string& user)
+{
+    return lookup_id(uid_cache, "/etc/passwd", 7, user);
+}
+
+std::optional<gid_t> lookup_gid(const std::string& group)
+{
+    return lookup_id(gid_cache, "/etc/group", 4, group);
+}
+
+std::optional<gid_t> lookup_login_gid(const std::string& user)
+{
+    auto passwd = load("/etc/passwd", 7, 0644);
+    for (const auto& entry: passwd.entries) {
+        if (entry.size() < 4) continue;
+        //else
+        if (entry[0] == user || (is_number(user) && entry[2] == user)) return parse_id(entry[3]);
+    }
+    return std::nullopt;
+}
+
+#ifdef TEST
+#include <iostream>
+
+static std::string read_file(const std::filesystem::path& path)
+{
+    std::ifstream ifs(path);
+    return std::string(std::istreambuf_iterator<char>(ifs), {});
+}
+
+// Provisions the same accounts twice against a temporary root: the second run
+// must not change anything, and entries genpack-init did not touch (comments,
+// empty trailing fields) must come out as they went in.
+int main()
+{
+    auto root = std::filesystem::temp_directory_path() / "genpack-init-accounts-test";
+    std::filesystem::remove_all(root);
+    std::filesystem::create_directories(root / "etc");
+    const std::map<std::string, std::string> initial = {
+        {"passwd", "# local accounts\nroot:x:0:0:root:/root:/bin/bash\nnobody:x:65534:65534:::/sbin/nologin\n"},
+        {"shadow", "root:*:19000:0:99999:7:::\nnobody:!:19000::::::\n"},
+        {"group", "# local groups\nroot:x:0:\nwheel:x:10:root\nnobody:x:65534:\n"},
+        {"gshadow", "root:::\nwheel:::root\nnobody:!::\n"},
+    };
+    for (const auto& [name, content]: initial) std::ofstream(root / "etc" / name) << content;
+    rootfs::set_root(root);
+
+    const std::vector<GroupSpec> groups = {
+        { .name = "video", .gid = 27, .system = true },
+    };
+    const std::vector<UserSpec> users = {
+        { .name = "alice", .groups = {"wheel", "video"}, .gecos = "Alice", .create_home = false },
+        { .name = "daemon", .system = true, .create_home = false },
+    };
+    int rst = 0;
+    auto check = [&rst](bool ok, const std::string& what) {
+        std::cout << (ok? "ok: " : "FAILED: ") << what << std::endl;
+        if (!ok) rst = 1;
+    };
+
+    check(provision_accounts(groups, users) == 0, "first run");
+    std::map<std::string, std::string> first;
+    for (const auto& [name, content]: initial) first[name] = read_file(root / "etc" / name);
+    check(provision_accounts(groups, users) == 0, "second run");
+    for (const auto& [name, content]: initial) {
+        check(read_file(root / "etc" / name) == first[name], name + " unchanged by the second run");
+    }
+
+    check(first["passwd"].starts_with("# local accounts\n"), "passwd comment kept");
+    check(first["group"].starts_with("# local groups\n"), "group comment kept");
+    check(first["shadow"].starts_with("root:*:19000:0:99999:7:::\nnobody:!:19000::::::\n"), "shadow trailing fields kept");
+    check(first["passwd"].find("nobody:x:65534:65534:::/sbin/nologin\n") != std::string::npos, "empty passwd fields kept");
+    check(first["group"].find("wheel:x:10:root,alice\n") != std::string::npos, "alice added to wheel");
+    check(first["gshadow"].find("wheel:::root,alice\n") != std::string::npos, "alice added to wheel in gshadow");
+    check(first["group"].find("video:x:27:alice\n") != std::string::npos, "video created with alice");
+    check(first["passwd"].find("alice:x:1000:1000:Alice:/home/alice:/bin/bash\n") != std::string::npos, "alice created");
+    check(first["passwd"].find("daemon:x:999:999::/:/sbin/nologin\n") != std::string::npos, "system user created");
+    check(lookup_login_gid("alice") == 1000u && lookup_login_gid("1000") == 1000u, "alice's login group");
+
+    std::filesystem::remove_all(root);
+    return rst;
+}
+#endif
@@ -0,0 +1,38 @@
+#pragma once
+#include <sys/types.h>
+#include <optional>
+#include <string>
+#include <vector>
+
+struct GroupSpec {
+    std::string name;
+    std::optional<gid_t> gid;           // allocated if not given
+    bool system = false;
+    std::vector<std::string> members;
+};
+
+struct UserSpec {
+    std::string name;
+    std::optional<uid_t> uid;           // allocated if not given
+    std::optional<std::string> group;   // primary group; a group named after the user if not given
+    std::vector<std::string> groups;    // supplementary groups, which must exist or be in the same batch
+    std::optional<std::string> home;    // /home/<name> (or / for system users) if not given
+    std::optional<std::string> shell;
+    std::optional<std::string> gecos;
+    std::optional<std::string> password;    // already hashed; locked if not given
+    std::vector<std::string> ssh_keys;  // written to ~/.ssh/authorized_keys
+    bool system = false;
+    bool create_home = true;
+};
+
+// Creates or updates the groups, then the users, reading /etc/passwd, shadow,
+// group and gshadow once and writing each changed file once (atomically).
+// Existing accounts keep their ids; given fields are updated and memberships
+// added. Returns the number of accounts that could not be provisioned.
+int provision_accounts(const std::vector<GroupSpec>& groups, const std::vector<UserSpec>& users);
+// Name (or numeric string) to id, from a cache of /etc/passwd and /etc/group
+// that is reloaded on a miss. Other NSS sources are not consulted.
+std::optional<uid_t> lookup_uid(const std::string& user);
+std::optional<gid_t> lookup_gid(const std::string& group);
+// The primary group in the user's passwd entry, as chown(1) uses for "user:"
+std::optional<gid_t> lookup_login_gid(const std::string& user);
@@ -1,14 +1,23 @@
 #include <sys/wait.h>
 
 #include <set>
+#include <optional>
 #include <iostream>
 #include <fstream>
 #include <filesystem>
+#include <format>
 #include <vector>
 
+#include "coldplug.h"
 #include "logging.h"
+#include "rootfs.h"
 
 static const char* modprobe = "/sbin/modprobe";
+static const char* state_file = "/run/genpack-init/coldplug.json";
+// flags devices whose modules coldplug() loaded, before 80-drivers.rules looks at them
+static const char* udev_rules = "/run/udev/rules.d/79-genpack-init-coldplug.rules";
+// same name as the stock rules, which a file in /run/udev/rules.d overrides
+static const char* drivers_rules = "/run/udev/rules.d/80-drivers.rules";
 
 static bool coldplug_done = false;
 
@@ -50,11 +59,13 @@ static std::set<std::string> resolve_modaliases(const std::set<std::string>& mod
     std::string output;
     char buffer[4096];
     ssize_t nread;
-    while ((nread = read(pipefd[0], buffer, sizeof(buffer))) > 0) {
-        output.append(buffer, nread);
+    while ((nread = read(pipefd[0], buffer, sizeof(buffer))) > 0 || (nread < 0 && errno == EINTR)) {
+        if (nread > 0) output.append(buffer, nread);
     }
     close(pipefd[0]);
-    waitpid(pid, nullptr, 0); // ignore status
+    while (waitpid(pid, nullptr, 0) < 0 && errno == EINTR) {
+        // ignore status
+    }
 
     std::set<std::string> modules;
     std::istringstream iss(output);
@@ -91,10 +102,122 @@ static int load_modules(const std::set<std::string>& modules)
     }
     // parent
     int status = 0;
-    waitpid(pid, &status, 0);
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {
+        // signals (e.g. from the watchdog) may interrupt the wait
+    }
     return WIFEXITED(status)? WEXITSTATUS(status): -1;
 }
 
+std::set<std::string> scan_modaliases(const std::filesystem::path& devices_dir)
+{
+    // find files exactly named 'modalias' under devices_dir in any level
+    std::set<std::string> modaliases;
+    for (const auto& entry: std::filesystem::recursive_directory_iterator(devices_dir)) {
+        if (entry.path().filename() == "modalias") {
+            std::ifstream ifs(entry.path());
+            if (!ifs) continue;
+            //else
+            std::string modalias;
+            ifs >> modalias;
+            // strip modalias
+            modalias.erase(std::remove(modalias.begin(), modalias.end(), '\n'), modalias.end());
+            modaliases.insert(modalias);
+        }
+    }
+    return modaliases;
+}
+
+template <typename T> static std::string json_array(const T& items)
+{
+    std::string json = "[";
+    for (const auto& item: items) {
+        if (json.size() > 1) json += ", ";
+        json += rootfs::json_string(item);
+    }
+    return json + "]";
+}
+
+static void write_file(const std::filesystem::path& path, const std::string& content)
+{
+    std::filesystem::create_directories(path.parent_path());
+    // rename() so that readers never see a partially written file
+    auto tmp = path;
+    tmp += ".tmp";
+    {
+        std::ofstream ofs(tmp);
+        ofs << content;
+        if (!ofs.flush()) throw std::runtime_error("Failed to write " + tmp.string());
+    }
+    std::filesystem::rename(tmp, path);
+}
+
+// The stock 80-drivers.rules with "kmod load" for MODALIAS skipped on flagged
+// devices. nullopt if there is none, the administrator overrides it in /etc
+// (which wins over /run anyway) or it has no such line to patch.
+static std::optional<std::string> drivers_rules_override()
+{
+    if (std::filesystem::exists(rootfs::path("/etc/udev/rules.d/80-drivers.rules"))) return std::nullopt;
+    //else
+    for (const char* dir: {"/usr/lib/udev/rules.d", "/lib/udev/rules.d"}) {
+        auto path = std::filesystem::path(dir) / "80-drivers.rules";
+        std::ifstream ifs(rootfs::path(path));
+        if (!ifs) continue;
+        //else
+        std::string rules = std::format("# generated by genpack-init from {}: \"kmod load\" is skipped for\n"
+            "# devices whose modules coldplug() already loaded (see 79-genpack-init-coldplug.rules)\n", path.string());
+        std::string line;
+        bool patched = false;
+        while (std::getline(ifs, line)) {
+            if (!line.starts_with("#") && line.find("ENV{MODALIAS}") != std::string::npos
+                    && line.find("RUN{builtin}+=\"kmod load\"") != std::string::npos) {
+                line = "ENV{GENPACK_INIT_COLDPLUGGED}!=\"1\", " + line;
+                patched = true;
+            }
+            rules += line + "\n";
+        }
+        if (!patched) return std::nullopt;
+        //else
+        return rules;
+    }
+    return std::nullopt;
+}
+
+// Records what coldplug() did, and tells udev not to load modules again for
+// these modaliases when systemd-udev-trigger replays "add" for every device.
+// Only those synthetic events (the kernel tags them with SYNTH_UUID) are
+// flagged with GENPACK_INIT_COLDPLUGGED=1; real hotplug is left alone.
+// MODALIAS itself is kept, as other rules and the udev database rely on it;
+// the flag takes effect through an override of 80-drivers.rules whose
+// "kmod load" rule skips flagged devices.
+static void write_coldplug_state(const std::set<std::string>& modaliases, const std::set<std::string>& modules, int status)
+{
+    write_file(rootfs::path(state_file), std::format("{{\"modaliases\": {}, \"modules\": {}, \"status\": {}}}\n",
+        json_array(modaliases), json_array(modules), status));
+    if (status != 0) return; // some modules may be missing; let udev retry them
+    //else
+    auto drivers = drivers_rules_override();
+    if (!drivers) {
+        logging::debug("80-drivers.rules not found or overridden in /etc, udev will load modules again");
+        return;
+    }
+    //else
+    std::string rules = "# generated by genpack-init: modules for these devices were loaded by coldplug()\n"
+        "# Replayed (synthetic) add events get GENPACK_INIT_COLDPLUGGED=1, which 80-drivers.rules\n"
+        "# in this directory checks before \"kmod load\".\n"
+        "ACTION!=\"add\", GOTO=\"genpack_init_coldplug_end\"\n"
+        "ENV{SYNTH_UUID}!=\"?*\", GOTO=\"genpack_init_coldplug_end\"\n"
+        "ENV{MODALIAS}!=\"?*\", GOTO=\"genpack_init_coldplug_end\"\n";
+    for (const auto& modalias: modaliases) {
+        // udev patterns have no escaping; such devices just go through kmod as usual
+        if (modalias.find_first_of("*?[]|\"\\") != std::string::npos) continue;
+        //else
+        rules += std::format("ENV{{MODALIAS}}==\"{}\", ENV{{GENPACK_INIT_COLDPLUGGED}}=\"1\", GOTO=\"genpack_init_coldplug_end\"\n", modalias);
+    }
+    rules += "LABEL=\"genpack_init_coldplug_end\"\n";
+    write_file(rootfs::path(udev_rules), rules);
+    write_file(rootfs::path(drivers_rules), *drivers);
+}
+
 void coldplug()
 {
     if (coldplug_done) {
@@ -102,22 +225,17 @@ void coldplug()
         return;
     }
     //else
-    // find files exactly named 'modalias' under /sys/devices in any level
     try {
-        std::set<std::string> modaliases;
-        for (const auto& entry: std::filesystem::recursive_directory_iterator("/sys/devices")) {
-            if (entry.path().filename() == "modalias") {
-                std::ifstream ifs(entry.path());
-                if (!ifs) continue;
-                //else
-                std::string modalias;
-                ifs >> modalias;
-                // strip modalias
-                modalias.erase(std::remove(modalias.begin(), modalias.end(), '\n'), modalias.end());
-                modaliases.insert(modalias);
-            }
+        auto modaliases = scan_modaliases(rootfs::path("/sys/devices"));
+        if (rootfs::dry_run()) {
+            // modprobe accepts the aliases themselves; resolving them against the host's modules would be meaningless
+            std::vector<std::string> action = {modprobe, "-a", "-b"};
+            action.insert(action.end(), modaliases.begin(), modaliases.end());
+            rootfs::record(action);
+            coldplug_done = true;
+            return;
         }
-
+        //else
         auto modules = resolve_modaliases(modaliases);
         std::string msg("Loading modules: ");
         bool first = true;
@@ -132,7 +250,14 @@ void coldplug()
         if (rst == 0) {
             logging::info("Modules loaded.");
         } else {
-            logging::warning("modpeobe returned non-zero exit status: " + std::to_string(rst));
+            logging::warning("modprobe returned non-zero exit status: " + std::to_string(rst));
+        }
+        try {
+            write_coldplug_state(modaliases, modules, rst);
+        }
+        catch (const std::exception& e) {
+            // udev will simply redo the work
+            logging::warning(std::format("Failed to record coldplug state: {}", e.what()));
         }
 
         coldplug_done = true;
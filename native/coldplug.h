@@ -1 +1,9 @@
+#include <set>
+#include <string>
+#include <filesystem>
+
+std::set<std::string> scan_modaliases(const std::filesystem::path& devices_dir = "/sys/devices");
+// Loads the modules for every device present. Once that succeeded, udev's
+// replayed add events for those devices are flagged GENPACK_INIT_COLDPLUGGED=1
+// and an override of 80-drivers.rules skips "kmod load" for them.
 void coldplug();
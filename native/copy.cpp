@@ -0,0 +1,313 @@
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+#include <sys/xattr.h>
+#include <linux/fs.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "copy.h"
+#include "platform.h"
+#include "logging.h"
+#include "rootfs.h"
+#include "formatter.h"
+
+namespace {
+
+struct FileTask {
+    std::filesystem::path src, dst;
+    struct stat st;
+};
+
+// shared by the workers; they must not log (logging may call into Python)
+struct CopyState {
+    std::atomic<size_t> next = 0;
+    std::atomic<uint64_t> bytes = 0, reflinked = 0;
+    std::mutex mutex;
+    std::vector<std::string> errors;
+    void error(const std::string& message) {
+        std::lock_guard lock(mutex);
+        errors.push_back(message);
+    }
+};
+
+std::string copy_xattrs(int src_fd, int dst_fd)
+{
+    auto len = flistxattr(src_fd, nullptr, 0);
+    if (len <= 0) return {};
+    //else
+    std::vector<char> names(len);
+    len = flistxattr(src_fd, names.data(), names.size());
+    if (len < 0) return std::format("flistxattr: {}", strerror(errno));
+    //else
+    std::vector<char> value;
+    for (const char* name = names.data(); name < names.data() + len; name += strlen(name) + 1) {
+        auto size = fgetxattr(src_fd, name, nullptr, 0);
+        if (size < 0) continue;
+        //else
+        value.resize(size);
+        size = fgetxattr(src_fd, name, value.data(), value.size());
+        if (size < 0) continue;
+        //else
+        if (fsetxattr(dst_fd, name, value.data(), size, 0) < 0 && errno != ENOTSUP) {
+            return std::format("fsetxattr({}): {}", name, strerror(errno));
+        }
+    }
+    return {};
+}
+
+// copy_xattrs() for entries without an fd of their own (directories, symlinks, device nodes)
+std::string copy_xattrs(const std::filesystem::path& src, const std::filesystem::path& dst, bool symlink)
+{
+    auto len = llistxattr(src.c_str(), nullptr, 0);
+    if (len <= 0) return {};
+    //else
+    std::vector<char> names(len);
+    len = llistxattr(src.c_str(), names.data(), names.size());
+    if (len < 0) return std::format("llistxattr: {}", strerror(errno));
+    //else
+    std::vector<char> value;
+    for (const char* name = names.data(); name < names.data() + len; name += strlen(name) + 1) {
+        auto size = lgetxattr(src.c_str(), name, nullptr, 0);
+        if (size < 0) continue;
+        //else
+        value.resize(size);
+        size = lgetxattr(src.c_str(), name, value.data(), value.size());
+        if (size < 0) continue;
+        //else
+        if (lsetxattr(dst.c_str(), name, value.data(), size, 0) < 0 && errno != ENOTSUP && !(symlink && errno == EPERM)) {
+            // (the kernel refuses user.* on symlinks with EPERM)
+            return std::format("lsetxattr({}): {}", name, strerror(errno));
+        }
+    }
+    return {};
+}
+
+// Returns an error message, empty on success
+std::string copy_data(int src_fd, int dst_fd, off_t size, CopyState& state)
+{
+    if (ioctl(dst_fd, FICLONE, src_fd) == 0) {
+        state.reflinked++;
+        state.bytes += size;
+        return {};
+    }
+    //else
+    off_t copied = 0;
+    bool use_copy_file_range = true;
+    while (copied < size) {
+        ssize_t n;
+        if (use_copy_file_range) {
+            n = copy_file_range(src_fd, nullptr, dst_fd, nullptr, size - copied, 0);
+            if (n < 0 && (errno == EXDEV || errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP) && copied == 0) {
+                use_copy_file_range = false;
+                continue;
+            }
+        } else {
+            n = sendfile(dst_fd, src_fd, nullptr, size - copied);
+        }
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return std::format("{}: {}", use_copy_file_range? "copy_file_range" : "sendfile", strerror(errno));
+        if (n == 0) break;  // file shrank while copying
+        //else
+        copied += n;
+    }
+    state.bytes += copied;
+    return {};
+}
+
+void copy_file(const FileTask& task, CopyState& state)
+{
+    int src_fd = open(task.src.c_str(), O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+    if (src_fd < 0) {
+        state.error(std::format("{}: {}", task.src, strerror(errno)));
+        return;
+    }
+    //else
+    unlink(task.dst.c_str());   // don't write through an existing hard link
+    int dst_fd = open(task.dst.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if (dst_fd < 0) {
+        state.error(std::format("{}: {}", task.dst, strerror(errno)));
+        close(src_fd);
+        return;
+    }
+    //else
+    auto error = copy_data(src_fd, dst_fd, task.st.st_size, state);
+    // ownership first: fchown clears setuid/setgid and security.capability
+    if (error.empty() && fchown(dst_fd, task.st.st_uid, task.st.st_gid) < 0) error = std::format("fchown: {}", strerror(errno));
+    if (error.empty()) error = copy_xattrs(src_fd, dst_fd);
+    if (error.empty() && fchmod(dst_fd, task.st.st_mode & 07777) < 0) error = std::format("fchmod: {}", strerror(errno));
+    struct timespec times[2] = { task.st.st_atim, task.st.st_mtim };
+    if (error.empty() && futimens(dst_fd, times) < 0) error = std::format("futimens: {}", strerror(errno));
+    if (!error.empty()) state.error(std::format("{}: {}", task.dst, error));
+    close(dst_fd);
+    close(src_fd);
+}
+
+// metadata of anything but regular files, which copy_file() handles with the fd
+std::string copy_metadata(const std::filesystem::path& src, const std::filesystem::path& dst, const struct stat& st)
+{
+    if (lchown(dst.c_str(), st.st_uid, st.st_gid) < 0) return std::format("lchown: {}", strerror(errno));
+    //else
+    if (!S_ISLNK(st.st_mode) && chmod(dst.c_str(), st.st_mode & 07777) < 0) return std::format("chmod: {}", strerror(errno));
+    //else
+    if (auto error = copy_xattrs(src, dst, S_ISLNK(st.st_mode)); !error.empty()) return error;
+    //else
+    struct timespec times[2] = { st.st_atim, st.st_mtim };
+    if (utimensat(AT_FDCWD, dst.c_str(), times, AT_SYMLINK_NOFOLLOW) < 0) return std::format("utimensat: {}", strerror(errno));
+    //else
+    return {};
+}
+
+} // namespace
+
+int copy_tree(const std::filesystem::path& _src, const std::filesystem::path& _dst, unsigned int jobs)
+{
+    if (rootfs::dry_run()) {
+        rootfs::record({"copy_tree", _src.string(), _dst.string()});
+        return 0;
+    }
+    //else
+    auto src = rootfs::path(_src), dst = rootfs::path(_dst);
+    struct stat st;
+    if (lstat(src.c_str(), &st) < 0 || !S_ISDIR(st.st_mode)) {
+        logging::error(std::format("copy_tree: {} is not a directory", src));
+        return 1;
+    }
+    //else
+    CopyState state;
+    std::vector<FileTask> dirs = {{src, dst, st}};
+    std::vector<FileTask> files;
+    std::vector<std::pair<std::filesystem::path, std::filesystem::path>> hardlinks; // (first copy, new link)
+    std::map<std::pair<dev_t, ino_t>, std::filesystem::path> seen;
+
+    // directories, symlinks and special files are created here; file data is left to the workers
+    std::error_code ec;
+    std::filesystem::create_directories(dst, ec);
+    if (ec) {
+        logging::error(std::format("copy_tree: {}: {}", dst, ec.message()));
+        return 1;
+    }
+    //else
+    for (auto it = std::filesystem::recursive_directory_iterator(src, ec); !ec && it != std::filesystem::recursive_directory_iterator(); it.increment(ec)) {
+        auto target = dst / it->path().lexically_relative(src);
+        if (lstat(it->path().c_str(), &st) < 0) {
+            state.error(std::format("{}: {}", it->path(), strerror(errno)));
+            continue;
+        }
+        //else
+        if (S_ISDIR(st.st_mode)) {
+            if (mkdir(target.c_str(), 0700) < 0 && errno != EEXIST) state.error(std::format("{}: {}", target, strerror(errno)));
+            dirs.push_back({it->path(), target, st});
+        } else if (S_ISREG(st.st_mode)) {
+            if (st.st_nlink > 1) {
+                auto [first, inserted] = seen.try_emplace({st.st_dev, st.st_ino}, target);
+                if (!inserted) {
+                    hardlinks.push_back({first->second, target});
+                    continue;
+                }
+            }
+            files.push_back({it->path(), target, st});
+        } else if (S_ISLNK(st.st_mode)) {
+            std::vector<char> link(st.st_size + 1);
+            auto len = readlink(it->path().c_str(), link.data(), link.size());
+            unlink(target.c_str());
+            if (len < 0 || symlink(std::string(link.data(), len).c_str(), target.c_str()) < 0) {
+                state.error(std::format("{}: {}", target, strerror(errno)));
+                continue;
+            }
+            //else
+            if (auto error = copy_metadata(it->path(), target, st); !error.empty()) state.error(std::format("{}: {}", target, error));
+        } else {
+            unlink(target.c_str());
+            if (mknod(target.c_str(), st.st_mode, st.st_rdev) < 0) {
+                state.error(std::format("{}: {}", target, strerror(errno)));
+                continue;
+            }
+            //else
+            if (auto error = copy_metadata(it->path(), target, st); !error.empty()) state.error(std::format("{}: {}", target, error));
+        }
+    }
+    if (ec) state.error(std::format("{}: {}", src, ec.message()));
+
+    if (jobs == 0) jobs = std::clamp<size_t>(get_platform_info().cpus.size(), 1, 8);
+    jobs = std::min<size_t>(jobs, std::max<size_t>(files.size(), 1));
+    auto worker = [&]() {
+        for (size_t i; (i = state.next++) < files.size(); ) copy_file(files[i], state);
+    };
+    std::vector<std::thread> threads;
+    for (unsigned int i = 1; i < jobs; i++) threads.emplace_back(worker);
+    worker();
+    for (auto& thread: threads) thread.join();
+
+    for (const auto& [first, link]: hardlinks) {
+        unlink(link.c_str());
+        if (::link(first.c_str(), link.c_str()) < 0) state.error(std::format("{}: {}", link, strerror(errno)));
+    }
+    // deepest first, as creating entries changes the parent's mtime
+    for (auto it = dirs.rbegin(); it != dirs.rend(); it++) {
+        if (auto error = copy_metadata(it->src, it->dst, it->st); !error.empty()) state.error(std::format("{}: {}", it->dst, error));
+    }
+
+    for (const auto& error: state.errors) {
+        logging::error(std::format("copy_tree: {}", error));
+    }
+    logging::info(std::format("Copied {} to {}: {} files, {} MiB ({} reflinked), {} hard links, {} errors", src, dst,
+        files.size(), state.bytes / 1024 / 1024, state.reflinked.load(), hardlinks.size(), state.errors.size()));
+    return state.errors.size();
+}
+
+#ifdef TEST
+#include <fstream>
+#include <iostream>
+
+// Needs root: setting security.capability takes CAP_SETFCAP
+int main()
+{
+    auto dir = std::filesystem::temp_directory_path() / "genpack-init-copy-test";
+    std::filesystem::remove_all(dir);
+    std::filesystem::create_directories(dir / "src");
+    auto src = dir / "src" / "ping";
+    std::ofstream(src) << "#!/bin/sh\n";
+    // struct vfs_cap_data, revision 2, effective: cap_net_raw (13)
+    const uint32_t cap[5] = { 0x02000001, 1u << 13, 0, 0, 0 };
+    if (chown(src.c_str(), 1, 1) < 0 || setxattr(src.c_str(), "security.capability", cap, sizeof(cap), 0) < 0) {
+        std::cout << "Skipped: cannot set security.capability (" << strerror(errno) << ")" << std::endl;
+        std::filesystem::remove_all(dir);
+        return 0;
+    }
+    //else
+    // posix_acl_xattr_header (version 2) + entries: default:user::rwx, default:group::r-x, default:other::r-x
+    struct { uint16_t tag, perm; uint32_t id; } __attribute__((packed)) entries[3] = {
+        {0x01, 7, UINT32_MAX}, {0x04, 5, UINT32_MAX}, {0x20, 5, UINT32_MAX} };
+    std::vector<char> acl(4 + sizeof(entries));
+    const uint32_t version = 2;
+    memcpy(acl.data(), &version, sizeof(version));
+    memcpy(acl.data() + 4, entries, sizeof(entries));
+    auto shared = dir / "src" / "shared";
+    std::filesystem::create_directory(shared);
+    bool acl_supported = setxattr(shared.c_str(), "system.posix_acl_default", acl.data(), acl.size(), 0) == 0;
+    if (!acl_supported) std::cout << "Skipped default ACL check (" << strerror(errno) << ")" << std::endl;
+
+    int rst = copy_tree(dir / "src", dir / "dst", 1);
+    uint32_t copied[5] = {};
+    auto len = getxattr((dir / "dst" / "ping").c_str(), "security.capability", copied, sizeof(copied));
+    std::cout << "errors=" << rst << ", security.capability " << (len < 0? strerror(errno) : "preserved") << std::endl;
+    if (len != sizeof(cap) || memcmp(cap, copied, sizeof(cap)) != 0) rst = 1;
+    if (acl_supported) {
+        std::vector<char> copied_acl(acl.size() + 64);
+        len = getxattr((dir / "dst" / "shared").c_str(), "system.posix_acl_default", copied_acl.data(), copied_acl.size());
+        std::cout << "directory default ACL " << (len < 0? strerror(errno) : "preserved") << std::endl;
+        if (len != (ssize_t)acl.size() || memcmp(acl.data(), copied_acl.data(), acl.size()) != 0) rst = 1;
+    }
+    std::filesystem::remove_all(dir);
+    return rst;
+}
+#endif
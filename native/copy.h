@@ -0,0 +1,9 @@
+#pragma once
+#include <filesystem>
+
+// Copies the tree under src into dst (merging into existing directories,
+// replacing files), preserving ownership, modes, xattrs, timestamps and hard
+// links. File data is reflinked (FICLONE) where possible, otherwise copied in
+// the kernel with copy_file_range() or sendfile(). Files are copied by
+// `jobs` threads (0 = one per CPU, up to 8). Returns the number of errors.
+int copy_tree(const std::filesystem::path& src, const std::filesystem::path& dst, unsigned int jobs = 0);
@@ -0,0 +1,175 @@
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+#include <libcryptsetup.h>
+
+#include "crypt.h"
+#include "platform.h"
+#include "logging.h"
+#include "rootfs.h"
+#include "formatter.h"
+
+static const uint64_t PBKDF_MEMORY_PER_JOB = 1024ULL * 1024 * 1024;
+
+static std::optional<std::string> read_key(const CryptVolume& volume)
+{
+    if (volume.key_fw_cfg) {
+        auto key = read_qemu_firmware_config(*volume.key_fw_cfg);
+        if (key) return key;
+    }
+    if (volume.key_file) {
+        auto path = rootfs::path("/run/initramfs/boot") / volume.key_file->relative_path();
+        std::ifstream ifs(path, std::ios::binary);
+        if (ifs) return std::string(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
+    }
+    return std::nullopt;
+}
+
+// Runs in a child process, one per volume: libcryptsetup and libdevmapper are
+// not thread-safe, but separate processes still derive their keys in parallel.
+// Returns the libcryptsetup result, no logging here.
+static int unlock(const CryptVolume& volume, std::string& key)
+{
+    struct crypt_device* cd = nullptr;
+    int r = crypt_init(&cd, volume.device.c_str());
+    if (r == 0) r = crypt_load(cd, CRYPT_LUKS, nullptr);
+    if (r == 0) {
+        uint32_t flags = (volume.discard? CRYPT_ACTIVATE_ALLOW_DISCARDS : 0) | (volume.readonly? CRYPT_ACTIVATE_READONLY : 0);
+        r = crypt_activate_by_passphrase(cd, volume.name.c_str(), CRYPT_ANY_SLOT, key.data(), key.size(), flags);
+    }
+    if (cd) crypt_free(cd);
+    explicit_bzero(key.data(), key.size());
+    return r;
+}
+
+struct UnlockJob {
+    size_t index;
+    pid_t pid;
+    int fd;     // the child writes its result here before exiting
+    std::chrono::steady_clock::time_point start;
+};
+
+static std::optional<UnlockJob> start_unlock(size_t index, const CryptVolume& volume, std::string& key)
+{
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) < 0) return std::nullopt;
+    //else
+    auto start = std::chrono::steady_clock::now();
+    auto pid = fork();
+    if (pid == 0) {
+        close(fds[0]);
+        int r = unlock(volume, key);
+        (void)write(fds[1], &r, sizeof(r));
+        _exit(0);
+    }
+    //else
+    close(fds[1]);
+    explicit_bzero(key.data(), key.size()); // the child has its own copy
+    if (pid < 0) {
+        close(fds[0]);
+        return std::nullopt;
+    }
+    //else
+    return UnlockJob { index, pid, fds[0], start };
+}
+
+static UnlockResult finish_unlock(const UnlockJob& job, const CryptVolume& volume)
+{
+    UnlockResult result { volume.name, false, {}, {} };
+    int r;
+    ssize_t len;
+    while ((len = read(job.fd, &r, sizeof(r))) < 0 && errno == EINTR) {}
+    close(job.fd);
+    int status = 0;
+    while (waitpid(job.pid, &status, 0) < 0 && errno == EINTR) {}
+    if (len != sizeof(r)) {
+        result.error = WIFSIGNALED(status)? std::format("worker killed by signal {}", WTERMSIG(status)) : "worker exited without a result";
+    } else {
+        result.ok = r >= 0;
+        if (!result.ok) result.error = r == -EPERM? "no key slot matches the key" : strerror(-r);
+    }
+    result.elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - job.start);
+    return result;
+}
+
+std::vector<UnlockResult> unlock_volumes(const std::vector<CryptVolume>& volumes, unsigned int jobs)
+{
+    std::vector<UnlockResult> results(volumes.size());
+    std::vector<std::string> keys(volumes.size());
+    std::vector<size_t> todo;
+    for (size_t i = 0; i < volumes.size(); i++) {
+        const auto& volume = volumes[i];
+        results[i] = { volume.name, false, {}, {} };
+        if (rootfs::dry_run()) {
+            rootfs::record({"cryptsetup", "open", volume.device.string(), volume.name});
+            results[i].ok = true;
+            continue;
+        }
+        //else
+        if (crypt_status(nullptr, volume.name.c_str()) == CRYPT_ACTIVE) {
+            logging::info(std::format("{}: already unlocked", volume.name));
+            results[i].ok = true;
+            continue;
+        }
+        //else
+        auto key = read_key(volume);
+        if (!key) {
+            results[i].error = "no key found";
+            logging::error(std::format("{}: no key found for {}", volume.name, volume.device));
+            continue;
+        }
+        //else
+        keys[i] = std::move(*key);
+        todo.push_back(i);
+    }
+
+    if (jobs == 0) {
+        const auto& platform = get_platform_info();
+        jobs = std::max<size_t>(1, std::min<size_t>(platform.cpus.size(), platform.memory / PBKDF_MEMORY_PER_JOB));
+    }
+    jobs = std::min<size_t>(jobs, todo.size());
+    auto start = std::chrono::steady_clock::now();
+    std::vector<UnlockJob> running;
+    size_t next = 0;
+    while (next < todo.size() || !running.empty()) {
+        while (next < todo.size() && running.size() < jobs) {
+            auto i = todo[next++];
+            auto job = start_unlock(i, volumes[i], keys[i]);
+            if (job) running.push_back(*job);
+            else results[i].error = std::format("failed to start worker: {}", strerror(errno));
+        }
+        if (running.empty()) continue;
+        //else
+        std::vector<struct pollfd> pfds;
+        for (const auto& job: running) pfds.push_back({ .fd = job.fd, .events = POLLIN });
+        if (poll(pfds.data(), pfds.size(), -1) < 0 && errno != EINTR) break;
+        //else
+        for (size_t n = running.size(); n-- > 0; ) {
+            if (!pfds[n].revents) continue;
+            //else
+            results[running[n].index] = finish_unlock(running[n], volumes[running[n].index]);
+            running.erase(running.begin() + n);
+        }
+    }
+    for (const auto& job: running) results[job.index] = finish_unlock(job, volumes[job.index]);
+
+    for (auto i: todo) {
+        const auto& result = results[i];
+        if (result.ok) {
+            logging::info(std::format("{}: unlocked {} in {}ms", result.name, volumes[i].device, result.elapsed.count()));
+        } else {
+            logging::error(std::format("{}: failed to unlock {}: {} ({}ms)", result.name, volumes[i].device, result.error, result.elapsed.count()));
+        }
+    }
+    if (!todo.empty()) {
+        logging::info(std::format("Unlocked {} volume(s) with {} job(s) in {}ms", todo.size(), jobs,
+            std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count()));
+    }
+    return results;
+}
@@ -0,0 +1,27 @@
+#pragma once
+#include <chrono>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <vector>
+
+struct CryptVolume {
+    std::filesystem::path device;
+    std::string name;                                   // mapped as /dev/mapper/<name>
+    std::optional<std::string> key_fw_cfg;              // fw_cfg entry, e.g. "opt/genpack/luks-key"
+    std::optional<std::filesystem::path> key_file;      // relative to the boot partition
+    bool discard = false;
+    bool readonly = false;
+};
+
+struct UnlockResult {
+    std::string name;
+    bool ok;
+    std::string error;
+    std::chrono::milliseconds elapsed;
+};
+
+// Opens LUKS volumes with libcryptsetup, several at a time (one child process
+// per volume) so that their key derivations overlap. jobs = 0 picks one per CPU, bounded by memory
+// since Argon2 may take up to 1GiB per volume. Results follow the input order.
+std::vector<UnlockResult> unlock_volumes(const std::vector<CryptVolume>& volumes, unsigned int jobs = 0);
@@ -1,21 +1,29 @@
 #include <sys/ioctl.h>
+#include <sys/socket.h>
 #include <linux/fs.h>
+#include <linux/netlink.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <unistd.h>
 
 #include <memory>
 #include <cstring>
 #include <filesystem>
+#include <string_view>
 
 #include <blkid/blkid.h>
 
 #include "disk.h"
 #include "logging.h"
+#include "rootfs.h"
 #include "subprocess.h"
+#include "swap.h"
+#include "watchdog.h"
 #include "formatter.h"
 
-std::optional<BlockDeviceInfo> get_block_device_info(const std::filesystem::path& path)
+std::optional<BlockDeviceInfo> get_block_device_info(const std::filesystem::path& _path)
 {
+    auto path = rootfs::path(_path);
     int fd = open(path.c_str(), O_RDONLY);
     if (fd < 0) {
         if (errno == ENOENT) {
@@ -56,8 +64,9 @@ std::optional<BlockDeviceInfo> get_block_device_info(const std::filesystem::path
     });
 }
 
-std::optional<PartitionInfo> get_partition_info(const std::filesystem::path& path)
+std::optional<PartitionInfo> get_partition_info(const std::filesystem::path& _path)
 {
+    auto path = rootfs::path(_path);
     auto _probe = blkid_new_probe_from_filename(path.c_str());
     if (!_probe) {
         logging::debug(std::format("Partition {} cannot be probed", path));
@@ -82,6 +91,116 @@ std::optional<PartitionInfo> get_partition_info(const std::filesystem::path& pat
     });
 }
 
+static std::string describe(const DeviceMatch& match)
+{
+    return match.uuid? "UUID=" + *match.uuid : match.label? "LABEL=" + *match.label : match.path? match.path->string() : "(any)";
+}
+
+static bool device_matches(const DeviceMatch& match, const std::filesystem::path& device, const std::optional<PartitionInfo>& info)
+{
+    if (match.path && rootfs::path(*match.path) != device
+            && std::filesystem::weakly_canonical(rootfs::path(*match.path)) != device) return false;
+    //else
+    if (match.uuid && (!info || info->uuid != match.uuid)) return false;
+    //else
+    if (match.label && (!info || info->label != match.label)) return false;
+    //else
+    return true;
+}
+
+// Checks a device that has just appeared against the matches still pending
+static void check_device(const std::filesystem::path& device, const std::vector<DeviceMatch>& matches,
+    std::vector<std::optional<FoundDevice>>& found, size_t& remaining)
+{
+    // probed lazily and at most once; path-only matches are decided without it
+    std::optional<PartitionInfo> info;
+    bool probed = false;
+    auto probe = [&]() -> const std::optional<PartitionInfo>& {
+        if (!probed) info = get_partition_info(device);
+        probed = true;
+        return info;
+    };
+    for (size_t i = 0; i < matches.size(); i++) {
+        if (found[i]) continue;
+        //else
+        if (!device_matches(matches[i], device, (matches[i].uuid || matches[i].label)? probe() : std::nullopt)) continue;
+        //else
+        found[i] = FoundDevice { device, probe().value_or(PartitionInfo{}) };
+        remaining--;
+        logging::info(std::format("Device {} found ({})", device, describe(matches[i])));
+    }
+}
+
+std::vector<std::optional<FoundDevice>> wait_for_devices(const std::vector<DeviceMatch>& matches, std::chrono::milliseconds timeout)
+{
+    std::vector<std::optional<FoundDevice>> found(matches.size());
+    size_t remaining = matches.size();
+
+    // listen before scanning, so that a device added in between is not missed
+    int fd = -1;
+    if (!rootfs::sandboxed()) {
+        fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT);
+        struct sockaddr_nl addr = { .nl_family = AF_NETLINK, .nl_groups = 1 /* kernel events */ };
+        if (fd >= 0 && bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+            close(fd);
+            fd = -1;
+        }
+        if (fd < 0) logging::warning(std::format("uevent socket unavailable ({}), only checking existing devices", strerror(errno)));
+    }
+    std::shared_ptr<void> fd_closer(nullptr, [fd](void*) { if (fd >= 0) close(fd); });
+
+    auto sys_class_block = rootfs::path("/sys/class/block");
+    auto scan = [&]() {
+        std::error_code ec;
+        for (auto it = std::filesystem::directory_iterator(sys_class_block, ec); !ec && it != std::filesystem::directory_iterator() && remaining > 0; it.increment(ec)) {
+            check_device(rootfs::path("/dev") / it->path().filename(), matches, found, remaining);
+        }
+    };
+    scan();
+
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    char buf[8192];
+    while (remaining > 0 && fd >= 0) {
+        auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+        if (left.count() <= 0) break;
+        //else
+        struct pollfd pfd = { .fd = fd, .events = POLLIN };
+        auto r = poll(&pfd, 1, left.count());
+        if (r < 0 && errno == EINTR && !watchdog::interrupted()) continue;
+        if (r <= 0) break;
+        //else
+        auto len = recv(fd, buf, sizeof(buf) - 1, 0);
+        if (len < 0 && errno == EINTR && !watchdog::interrupted()) continue;
+        if (len < 0 && errno == ENOBUFS) {
+            // the socket overflowed and events were lost: whatever they announced is in sysfs by now
+            logging::debug("uevent socket overflowed, rescanning block devices");
+            scan();
+            continue;
+        }
+        if (len <= 0) break;
+        //else
+        buf[len] = '\0';
+        // "ACTION@DEVPATH\0KEY=VALUE\0..."
+        std::string_view action, subsystem, devname;
+        for (const char* p = buf; p < buf + len; p += strlen(p) + 1) {
+            std::string_view field(p);
+            if (field.starts_with("ACTION=")) action = field.substr(7);
+            else if (field.starts_with("SUBSYSTEM=")) subsystem = field.substr(10);
+            else if (field.starts_with("DEVNAME=")) devname = field.substr(8);
+        }
+        if (subsystem != "block" || devname.empty() || (action != "add" && action != "change")) continue;
+        //else
+        check_device(rootfs::path("/dev") / std::string(devname), matches, found, remaining);
+    }
+
+    for (size_t i = 0; i < matches.size(); i++) {
+        if (found[i]) continue;
+        //else
+        logging::warning(std::format("Device {} not found within {}ms", describe(matches[i]), timeout.count()));
+    }
+    return found;
+}
+
 int parted(const std::filesystem::path& disk, const std::string& command)
 {
     return run_subprocess({"parted", disk, command});
@@ -101,13 +220,7 @@ int mkfs(const std::filesystem::path& device, const std::string& fstype, const s
 
 int mkswap(const std::filesystem::path& device, const std::optional<std::string>& label)
 {
-    std::vector<std::string> cmdline = {"mkswap"};
-    if (label) {
-        cmdline.push_back("-L");
-        cmdline.push_back(*label);
-    }
-    cmdline.push_back(device);
-    return run_subprocess(cmdline);
+    return write_swap_header(device, label);
 }
 
 int mount(const std::filesystem::path& device, const std::filesystem::path& mountpoint, const std::optional<std::string>& fstype, const std::optional<std::string>& options)
@@ -1,6 +1,8 @@
 #include <optional>
 #include <map>
 #include <string>
+#include <vector>
+#include <chrono>
 #include <cstdint>
 
 struct BlockDeviceInfo {
@@ -15,8 +17,24 @@ struct PartitionInfo {
     std::optional<std::string> type;
 };
 
+// What wait_for_devices() looks for; every given field has to match
+struct DeviceMatch {
+    std::optional<std::string> uuid;
+    std::optional<std::string> label;
+    std::optional<std::filesystem::path> path;
+};
+
+struct FoundDevice {
+    std::filesystem::path name;
+    PartitionInfo info;
+};
+
 std::optional<BlockDeviceInfo> get_block_device_info(const std::filesystem::path& path);
 std::optional<PartitionInfo> get_partition_info(const std::filesystem::path& path);
+// Waits until a block device matching each entry has appeared, using kernel
+// uevents rather than polling. Results are in the order of matches; nullopt
+// for those still missing when the timeout expires.
+std::vector<std::optional<FoundDevice>> wait_for_devices(const std::vector<DeviceMatch>& matches, std::chrono::milliseconds timeout);
 int parted(const std::filesystem::path& disk, const std::string& command);
 int mkfs(const std::filesystem::path& device, const std::string& fstype, const std::optional<std::string>& label = std::nullopt);
 int mkswap(const std::filesystem::path& device, const std::optional<std::string>& label = std::nullopt);
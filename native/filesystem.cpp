@@ -1,34 +1,108 @@
+#include <unistd.h>
+
+#include <cstring>
 #include <regex>
 
 #include "logging.h"
 #include "formatter.h"
 #include "filesystem.h"
+#include "accounts.h"
+#include "rootfs.h"
 #include "subprocess.h"
 
-int chown(const std::string& user, const std::vector<std::filesystem::path>& paths, const std::optional<std::string>& group, bool recursive)
+// Like chown -R: named paths are followed, nothing below them is
+static int change_owner(const std::vector<std::filesystem::path>& paths, uid_t uid, gid_t gid, bool recursive)
 {
-    std::vector<std::string> cmdline = {"chown"};
-    if (recursive) {
-        cmdline.push_back("-R");
+    int failed = 0;
+    for (const auto& _path: paths) {
+        auto path = rootfs::path(_path);
+        if (::chown(path.c_str(), uid, gid) < 0) {
+            logging::error(std::format("chown({}) failed: {}", path, strerror(errno)));
+            failed++;
+            continue;
+        }
+        //else
+        if (!recursive || !std::filesystem::is_directory(path)) continue;
+        //else
+        std::error_code ec;
+        for (auto it = std::filesystem::recursive_directory_iterator(path, ec); !ec && it != std::filesystem::recursive_directory_iterator(); it.increment(ec)) {
+            if (lchown(it->path().c_str(), uid, gid) < 0) {
+                logging::error(std::format("lchown({}) failed: {}", it->path(), strerror(errno)));
+                failed++;
+            }
+        }
+        if (ec) {
+            logging::error(std::format("{}: {}", path, ec.message()));
+            failed++;
+        }
     }
-    cmdline.push_back(user + (group? ":" + *group: ""));
-    for (const auto& path: paths) {
-        cmdline.push_back(path.string());
+    return failed > 0? 1 : 0;
+}
+
+// Names are resolved against the target system's account databases (see accounts.cpp).
+// Only /etc/passwd and /etc/group are read; NSS sources other than files (LDAP,
+// sssd, systemd-userdb, ...) are not consulted, unlike chown(1).
+int chown(const std::string& _user, const std::vector<std::filesystem::path>& paths, const std::optional<std::string>& _group, bool recursive)
+{
+    // "user:group" is accepted as well, as chown(1) does, and so is "user:" for the user's login group
+    auto user = _user;
+    auto group = _group;
+    bool login_group = false;
+    if (auto colon = user.find(':'); colon != std::string::npos) {
+        if (!group && colon + 1 < user.size()) group = user.substr(colon + 1);
+        else if (!group) login_group = true;
+        user = user.substr(0, colon);
     }
-    return run_subprocess(cmdline);
+    if (rootfs::dry_run()) {
+        std::vector<std::string> cmdline = {"chown"};
+        if (recursive) cmdline.push_back("-R");
+        cmdline.push_back(user + (group? ":" + *group: login_group? ":" : ""));
+        for (const auto& path: paths) cmdline.push_back(path.string());
+        rootfs::record(cmdline);
+        return 0;
+    }
+    //else
+    auto uid = lookup_uid(user);
+    if (!uid) {
+        logging::error(std::format("chown: unknown user {}", user));
+        return 1;
+    }
+    //else
+    std::optional<gid_t> gid;
+    if (group) {
+        gid = lookup_gid(*group);
+        if (!gid) {
+            logging::error(std::format("chown: unknown group {}", *group));
+            return 1;
+        }
+    } else if (login_group) {
+        gid = lookup_login_gid(user);
+        if (!gid) {
+            logging::error(std::format("chown: no login group for {}", user));
+            return 1;
+        }
+    }
+    return change_owner(paths, *uid, gid.value_or((gid_t)-1), recursive);
 }
 
 int chgrp(const std::string& group, const std::vector<std::filesystem::path>& paths, bool recursive)
 {
-    std::vector<std::string> cmdline = {"chgrp"};
-    if (recursive) {
-        cmdline.push_back("-R");
+    if (rootfs::dry_run()) {
+        std::vector<std::string> cmdline = {"chgrp"};
+        if (recursive) cmdline.push_back("-R");
+        cmdline.push_back(group);
+        for (const auto& path: paths) cmdline.push_back(path.string());
+        rootfs::record(cmdline);
+        return 0;
     }
-    cmdline.push_back(group);
-    for (const auto& path: paths) {
-        cmdline.push_back(path.string());
+    //else
+    auto gid = lookup_gid(group);
+    if (!gid) {
+        logging::error(std::format("chgrp: unknown group {}", group));
+        return 1;
     }
-    return run_subprocess(cmdline);
+    //else
+    return change_owner(paths, (uid_t)-1, *gid, recursive);
 }
 
 int chmod(const std::string& mode, const std::vector<std::filesystem::path>& paths, bool recursive)
@@ -0,0 +1,315 @@
+#include <sys/socket.h>
+#include <net/if.h>     // before linux/if.h, which then leaves out what glibc already defines
+#include <linux/if.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <map>
+#include <set>
+#include <memory>
+
+#include "network.h"
+#include "logging.h"
+#include "rootfs.h"
+#include "watchdog.h"
+#include "formatter.h"
+
+namespace {
+
+struct Prefix {
+    int family;
+    unsigned char addr[16];
+    size_t len;
+    int prefixlen;
+};
+
+std::optional<Prefix> parse_prefix(const std::string& cidr)
+{
+    auto slash = cidr.find('/');
+    auto address = cidr.substr(0, slash);
+    Prefix prefix;
+    if (inet_pton(AF_INET, address.c_str(), prefix.addr) == 1) {
+        prefix.family = AF_INET;
+        prefix.len = 4;
+    } else if (inet_pton(AF_INET6, address.c_str(), prefix.addr) == 1) {
+        prefix.family = AF_INET6;
+        prefix.len = 16;
+    } else {
+        return std::nullopt;
+    }
+    prefix.prefixlen = prefix.len * 8;
+    if (slash != std::string::npos) {
+        try {
+            prefix.prefixlen = std::stoi(cidr.substr(slash + 1));
+        }
+        catch (const std::exception&) {
+            return std::nullopt;
+        }
+        if (prefix.prefixlen < 0 || prefix.prefixlen > (int)prefix.len * 8) return std::nullopt;
+    }
+    return prefix;
+}
+
+// Several rtnetlink requests sent with one sendto(), each acknowledged separately
+class NetlinkBatch {
+public:
+    void begin(uint16_t type, uint16_t flags, const void* payload, size_t len, const std::string& description) {
+        buf_.resize(NLMSG_ALIGN(buf_.size()));
+        current_ = buf_.size();
+        buf_.resize(current_ + NLMSG_HDRLEN);
+        append(payload, len);
+        auto nlh = header();
+        nlh->nlmsg_type = type;
+        nlh->nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK | flags;
+        nlh->nlmsg_seq = ++seq_;
+        nlh->nlmsg_len = buf_.size() - current_;
+        pending_[seq_] = description;
+    }
+    void attr(uint16_t type, const void* data, size_t len) {
+        buf_.resize(NLMSG_ALIGN(buf_.size()));
+        struct rtattr rta = { .rta_len = (unsigned short)RTA_LENGTH(len), .rta_type = type };
+        append(&rta, sizeof(rta));
+        append(data, len);
+        header()->nlmsg_len = buf_.size() - current_;
+    }
+    bool empty() const { return pending_.empty(); }
+    // Returns the number of failed requests
+    int send(int fd);
+private:
+    void append(const void* data, size_t len) {
+        auto p = static_cast<const char*>(data);
+        buf_.insert(buf_.end(), p, p + len);
+        buf_.resize(NLMSG_ALIGN(buf_.size()));
+    }
+    struct nlmsghdr* header() { return reinterpret_cast<struct nlmsghdr*>(buf_.data() + current_); }
+
+    std::vector<char> buf_;
+    size_t current_ = 0;
+    uint32_t seq_ = 0;
+    std::map<uint32_t, std::string> pending_;
+};
+
+int NetlinkBatch::send(int fd)
+{
+    struct sockaddr_nl kernel = { .nl_family = AF_NETLINK };
+    if (sendto(fd, buf_.data(), buf_.size(), 0, (struct sockaddr*)&kernel, sizeof(kernel)) < 0) {
+        logging::error(std::format("rtnetlink: sendto failed: {}", strerror(errno)));
+        return pending_.size();
+    }
+    //else
+    int failed = 0;
+    std::vector<char> reply(65536);
+    while (!pending_.empty()) {
+        auto len = recv(fd, reply.data(), reply.size(), 0);
+        if (len < 0 && errno == EINTR && !watchdog::interrupted()) continue;
+        if (len <= 0) {
+            logging::error(std::format("rtnetlink: no reply for {} request(s): {}", pending_.size(), strerror(errno)));
+            return failed + pending_.size();
+        }
+        //else
+        for (auto nlh = (struct nlmsghdr*)reply.data(); NLMSG_OK(nlh, (size_t)len); nlh = NLMSG_NEXT(nlh, len)) {
+            if (nlh->nlmsg_type != NLMSG_ERROR) continue;
+            //else
+            auto it = pending_.find(nlh->nlmsg_seq);
+            if (it == pending_.end()) continue;
+            //else
+            auto err = (struct nlmsgerr*)NLMSG_DATA(nlh);
+            if (err->error == 0) {
+                logging::info(it->second);
+            } else {
+                logging::error(std::format("{}: {}", it->second, strerror(-err->error)));
+                failed++;
+            }
+            pending_.erase(it);
+        }
+    }
+    return failed;
+}
+
+int open_rtnetlink(uint32_t groups)
+{
+    int fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+    if (fd < 0) {
+        logging::error(std::format("rtnetlink: socket failed: {}", strerror(errno)));
+        return -1;
+    }
+    //else
+    struct sockaddr_nl local = { .nl_family = AF_NETLINK, .nl_groups = groups };
+    if (bind(fd, (struct sockaddr*)&local, sizeof(local)) < 0) {
+        logging::error(std::format("rtnetlink: bind failed: {}", strerror(errno)));
+        close(fd);
+        return -1;
+    }
+    //else
+    struct timeval tv = { .tv_sec = 5, .tv_usec = 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    return fd;
+}
+
+} // namespace
+
+int configure_network(const std::vector<LinkConfig>& links)
+{
+    if (rootfs::dry_run()) {
+        for (const auto& link: links) {
+            std::vector<std::string> action = {"ip", "link", "set", link.interface, link.up? "up" : "down"};
+            if (link.mtu) action.insert(action.end(), {"mtu", std::to_string(*link.mtu)});
+            rootfs::record(action);
+            for (const auto& address: link.addresses) rootfs::record({"ip", "addr", "replace", address, "dev", link.interface});
+            for (const auto& route: link.routes) {
+                action = {"ip", "route", "replace", route.destination};
+                if (route.gateway) action.insert(action.end(), {"via", *route.gateway});
+                action.insert(action.end(), {"dev", link.interface});
+                if (route.metric) action.insert(action.end(), {"metric", std::to_string(*route.metric)});
+                rootfs::record(action);
+            }
+        }
+        return 0;
+    }
+    //else
+    int failed = 0;
+    NetlinkBatch batch;
+    std::vector<std::pair<const LinkConfig*, int>> resolved;
+    for (const auto& link: links) {
+        int index = if_nametoindex(link.interface.c_str());
+        if (index == 0) {
+            logging::error(std::format("{}: no such interface", link.interface));
+            failed++;
+            continue;
+        }
+        //else
+        resolved.push_back({&link, index});
+    }
+
+    // links first: addresses and routes on a down link would be pointless, and routes need the addresses
+    for (const auto& [link, index]: resolved) {
+        struct ifinfomsg ifi = {};
+        ifi.ifi_family = AF_UNSPEC;
+        ifi.ifi_index = index;
+        ifi.ifi_flags = link->up? IFF_UP : 0;
+        ifi.ifi_change = IFF_UP;
+        batch.begin(RTM_NEWLINK, 0, &ifi, sizeof(ifi), std::format("{}: link {}{}", link->interface,
+            link->up? "up" : "down", link->mtu? std::format(", mtu {}", *link->mtu) : ""));
+        if (link->mtu) batch.attr(IFLA_MTU, &*link->mtu, sizeof(uint32_t));
+    }
+    for (const auto& [link, index]: resolved) {
+        for (const auto& address: link->addresses) {
+            auto prefix = parse_prefix(address);
+            if (!prefix) {
+                logging::error(std::format("{}: invalid address '{}'", link->interface, address));
+                failed++;
+                continue;
+            }
+            //else
+            struct ifaddrmsg ifa = {};
+            ifa.ifa_family = prefix->family;
+            ifa.ifa_prefixlen = prefix->prefixlen;
+            ifa.ifa_scope = RT_SCOPE_UNIVERSE;
+            ifa.ifa_index = index;
+            batch.begin(RTM_NEWADDR, NLM_F_CREATE | NLM_F_REPLACE, &ifa, sizeof(ifa), std::format("{}: address {}", link->interface, address));
+            batch.attr(IFA_LOCAL, prefix->addr, prefix->len);
+            batch.attr(IFA_ADDRESS, prefix->addr, prefix->len);
+        }
+    }
+    for (const auto& [link, index]: resolved) {
+        for (const auto& route: link->routes) {
+            auto dst = route.destination == "default"? std::nullopt : parse_prefix(route.destination);
+            auto gateway = route.gateway? parse_prefix(*route.gateway) : std::nullopt;
+            if ((route.destination != "default" && !dst) || (route.gateway && !gateway)
+                    || (dst && gateway && dst->family != gateway->family)) {
+                logging::error(std::format("{}: invalid route to {}", link->interface, route.destination));
+                failed++;
+                continue;
+            }
+            //else
+            struct rtmsg rtm = {};
+            rtm.rtm_family = dst? dst->family : gateway? gateway->family : AF_INET;
+            rtm.rtm_dst_len = dst? dst->prefixlen : 0;
+            rtm.rtm_table = RT_TABLE_MAIN;
+            rtm.rtm_protocol = RTPROT_BOOT;
+            rtm.rtm_scope = gateway? RT_SCOPE_UNIVERSE : RT_SCOPE_LINK;
+            rtm.rtm_type = RTN_UNICAST;
+            batch.begin(RTM_NEWROUTE, NLM_F_CREATE | NLM_F_REPLACE, &rtm, sizeof(rtm), std::format("{}: route {}{}", link->interface,
+                route.destination, route.gateway? " via " + *route.gateway : ""));
+            if (dst) batch.attr(RTA_DST, dst->addr, dst->len);
+            if (gateway) batch.attr(RTA_GATEWAY, gateway->addr, gateway->len);
+            uint32_t oif = index;
+            batch.attr(RTA_OIF, &oif, sizeof(oif));
+            if (route.metric) batch.attr(RTA_PRIORITY, &*route.metric, sizeof(uint32_t));
+        }
+    }
+    if (batch.empty()) return failed;
+    //else
+    int fd = open_rtnetlink(0);
+    if (fd < 0) return failed + 1;
+    //else
+    failed += batch.send(fd);
+    close(fd);
+    return failed;
+}
+
+std::vector<std::string> wait_for_carrier(const std::vector<std::string>& interfaces, std::chrono::milliseconds timeout)
+{
+    std::set<std::string> waiting(interfaces.begin(), interfaces.end());
+    if (waiting.empty() || rootfs::dry_run()) return {};
+    //else
+    // subscribe before dumping, so that no transition falls between the two
+    int fd = open_rtnetlink(RTMGRP_LINK);
+    if (fd < 0) return interfaces;
+    //else
+    std::shared_ptr<void> fd_closer(nullptr, [fd](void*) { close(fd); });
+    struct {
+        struct nlmsghdr nlh;
+        struct ifinfomsg ifi;
+    } req = {};
+    req.nlh.nlmsg_len = sizeof(req);
+    req.nlh.nlmsg_type = RTM_GETLINK;
+    req.nlh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+    req.nlh.nlmsg_seq = 1;
+    req.ifi.ifi_family = AF_UNSPEC;
+    struct sockaddr_nl kernel = { .nl_family = AF_NETLINK };
+    if (sendto(fd, &req, sizeof(req), 0, (struct sockaddr*)&kernel, sizeof(kernel)) < 0) {
+        logging::error(std::format("rtnetlink: RTM_GETLINK failed: {}", strerror(errno)));
+        return interfaces;
+    }
+    //else
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    std::vector<char> buf(65536);
+    while (!waiting.empty()) {
+        auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+        if (remaining.count() <= 0) break;
+        //else
+        struct pollfd pfd = { .fd = fd, .events = POLLIN };
+        auto r = poll(&pfd, 1, remaining.count());
+        if (r < 0 && errno == EINTR && !watchdog::interrupted()) continue;
+        if (r <= 0) break;
+        //else
+        auto len = recv(fd, buf.data(), buf.size(), 0);
+        if (len < 0 && ((errno == EINTR && !watchdog::interrupted()) || errno == ENOBUFS)) continue; // ENOBUFS: events were dropped, later ones still count
+        if (len <= 0) break;
+        //else
+        for (auto nlh = (struct nlmsghdr*)buf.data(); NLMSG_OK(nlh, (size_t)len); nlh = NLMSG_NEXT(nlh, len)) {
+            if (nlh->nlmsg_type != RTM_NEWLINK) continue;
+            //else
+            auto ifi = (struct ifinfomsg*)NLMSG_DATA(nlh);
+            if (!(ifi->ifi_flags & IFF_LOWER_UP)) continue;
+            //else
+            int attrlen = IFLA_PAYLOAD(nlh);
+            for (auto rta = IFLA_RTA(ifi); RTA_OK(rta, attrlen); rta = RTA_NEXT(rta, attrlen)) {
+                if (rta->rta_type != IFLA_IFNAME) continue;
+                //else
+                std::string name((const char*)RTA_DATA(rta));
+                if (waiting.erase(name)) logging::info(std::format("{}: carrier detected", name));
+                break;
+            }
+        }
+    }
+    for (const auto& name: waiting) {
+        logging::warning(std::format("{}: no carrier after {}ms", name, timeout.count()));
+    }
+    return std::vector<std::string>(waiting.begin(), waiting.end());
+}
@@ -0,0 +1,28 @@
+#pragma once
+#include <chrono>
+#include <optional>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+struct NetworkRoute {
+    std::string destination = "default";    // "default" or CIDR
+    std::optional<std::string> gateway;
+    std::optional<uint32_t> metric;
+};
+
+struct LinkConfig {
+    std::string interface;
+    bool up = true;
+    std::optional<uint32_t> mtu;
+    std::vector<std::string> addresses;     // CIDR, IPv4 or IPv6
+    std::vector<NetworkRoute> routes;
+};
+
+// Sets link state/MTU, then addresses, then routes for all links in a single
+// batched rtnetlink transaction. Addresses and routes replace existing ones.
+// Returns the number of requests the kernel rejected.
+int configure_network(const std::vector<LinkConfig>& links);
+// Waits for carrier on all interfaces at once, using link notifications.
+// Returns the interfaces still without carrier when the timeout expires.
+std::vector<std::string> wait_for_carrier(const std::vector<std::string>& interfaces, std::chrono::milliseconds timeout);
@@ -0,0 +1,288 @@
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <linux/blkpg.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <array>
+#include <memory>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <optional>
+
+#include "partition.h"
+#include "disk.h"
+#include "logging.h"
+#include "rootfs.h"
+#include "subprocess.h"
+#include "formatter.h"
+
+// UEFI spec 5.3.2; all fields little endian
+struct gpt_header {
+    char signature[8];
+    uint32_t revision;
+    uint32_t header_size;
+    uint32_t header_crc32;
+    uint32_t reserved;
+    uint64_t my_lba;
+    uint64_t alternate_lba;
+    uint64_t first_usable_lba;
+    uint64_t last_usable_lba;
+    uint8_t disk_guid[16];
+    uint64_t partition_entry_lba;
+    uint32_t num_partition_entries;
+    uint32_t sizeof_partition_entry;
+    uint32_t partition_entry_array_crc32;
+} __attribute__((packed));
+
+struct gpt_entry {
+    uint8_t type_guid[16];
+    uint8_t unique_guid[16];
+    uint64_t starting_lba;
+    uint64_t ending_lba;
+    uint64_t attributes;
+    uint16_t name[36];
+} __attribute__((packed));
+
+static const uint64_t ALIGNMENT = 1024 * 1024;
+
+static uint32_t crc32(const void* data, size_t len)
+{
+    static const auto table = []() {
+        std::array<uint32_t, 256> table;
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++) c = c & 1? 0xedb88320 ^ (c >> 1) : c >> 1;
+            table[i] = c;
+        }
+        return table;
+    }();
+    uint32_t crc = 0xffffffff;
+    auto p = static_cast<const uint8_t*>(data);
+    for (size_t i = 0; i < len; i++) crc = table[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+    return crc ^ 0xffffffff;
+}
+
+static uint32_t header_crc(gpt_header header)
+{
+    header.header_crc32 = 0;
+    return crc32(&header, std::min<size_t>(header.header_size, sizeof(header)));
+}
+
+static std::string read_sysfs(const std::filesystem::path& path)
+{
+    std::ifstream ifs(path);
+    std::string value;
+    if (ifs) std::getline(ifs, value);
+    return value;
+}
+
+static bool pread_all(int fd, void* buf, size_t len, off_t offset)
+{
+    return pread(fd, buf, len, offset) == (ssize_t)len;
+}
+
+static bool pwrite_all(int fd, const void* buf, size_t len, off_t offset)
+{
+    return pwrite(fd, buf, len, offset) == (ssize_t)len;
+}
+
+// Mount point of the block device, by device number or by source (btrfs reports anonymous device numbers)
+static std::optional<std::filesystem::path> find_mountpoint(const std::string& devnum, const std::filesystem::path& device)
+{
+    std::ifstream ifs(rootfs::path("/proc/self/mountinfo"));
+    std::string line;
+    while (std::getline(ifs, line)) {
+        std::istringstream iss(line);
+        std::string id, parent, majmin, root, mountpoint, field;
+        iss >> id >> parent >> majmin >> root >> mountpoint;
+        while (iss >> field && field != "-") {}
+        std::string fstype, source;
+        iss >> fstype >> source;
+        if (majmin == devnum || source == device.string()) return mountpoint;
+    }
+    return std::nullopt;
+}
+
+// resize2fs refuses an unmounted filesystem that has not just been checked.
+// Offline it is quick and nothing may mount it halfway, so it runs to completion.
+static int resize_ext_offline(const std::filesystem::path& partition)
+{
+    // e2fsck -p: 1 = errors corrected, 2 = corrected but reboot advised; both leave it resizable
+    auto rst = run_subprocess({"e2fsck", "-f", "-p", partition.string()});
+    if (rst < 0 || rst > 2) {
+        logging::error(std::format("e2fsck on {} failed (status {}), not growing it", partition, rst));
+        return 1;
+    }
+    //else
+    if (run_subprocess({"resize2fs", partition.string()}) != 0) {
+        logging::error(std::format("resize2fs on {} failed", partition));
+        return 1;
+    }
+    //else
+    logging::info(std::format("Grew filesystem on {}", partition));
+    return 0;
+}
+
+static int resize_filesystem(const std::filesystem::path& partition, const std::string& devnum)
+{
+    auto info = get_partition_info(partition);
+    auto type = info && info->type? *info->type : std::string();
+    auto mountpoint = find_mountpoint(devnum, partition);
+    bool ext = type == "ext2" || type == "ext3" || type == "ext4";
+    if (ext && !mountpoint) return resize_ext_offline(partition);
+    //else
+    std::vector<std::string> cmdline;
+    if (ext) {
+        cmdline = {"resize2fs", partition.string()};
+    } else if (type == "xfs" && mountpoint) {
+        cmdline = {"xfs_growfs", mountpoint->string()};
+    } else if (type == "btrfs" && mountpoint) {
+        cmdline = {"btrfs", "filesystem", "resize", "max", mountpoint->string()};
+    } else {
+        logging::warning(std::format("{}: don't know how to grow {} filesystem{}", partition,
+            type.empty()? "unknown" : type, mountpoint? "" : " that is not mounted"));
+        return 1;
+    }
+    //else online resize: can take a while on a large disk and the system is usable meanwhile
+    auto pid = spawn_subprocess(cmdline);
+    if (pid < 0) {
+        logging::error(std::format("Failed to start {}", cmdline[0]));
+        return 1;
+    }
+    //else
+    logging::info(std::format("Growing {} filesystem on {} in the background (pid {})", type, partition, pid));
+    return 0;
+}
+
+int grow_partition_and_filesystem(const std::filesystem::path& partition)
+{
+    auto name = std::filesystem::canonical(rootfs::path(partition)).filename().string();
+    auto sys_part = rootfs::path("/sys/class/block") / name;
+    if (!std::filesystem::exists(sys_part / "partition")) {
+        logging::error(std::format("{} is not a partition", partition));
+        return 1;
+    }
+    //else
+    int partno = std::stoi(read_sysfs(sys_part / "partition"));
+    uint64_t start512 = std::stoull(read_sysfs(sys_part / "start"));
+    auto devnum = read_sysfs(sys_part / "dev");
+    auto disk = std::filesystem::path("/dev") / std::filesystem::canonical(sys_part).parent_path().filename();
+    auto disk_info = get_block_device_info(disk);
+    if (!disk_info) return 1;
+    //else
+    const uint64_t ss = disk_info->logical_sector_size;
+    const uint64_t total = disk_info->num_logical_sectors;
+
+    int fd = open(rootfs::path(disk).c_str(), (rootfs::dry_run()? O_RDONLY : O_RDWR) | O_CLOEXEC);
+    if (fd < 0) {
+        logging::error(std::format("open({}) failed: {}", disk, strerror(errno)));
+        return 1;
+    }
+    //else
+    std::shared_ptr<void> fd_closer(nullptr, [fd](void*) { close(fd); });
+
+    gpt_header header;
+    if (!pread_all(fd, &header, sizeof(header), ss) || memcmp(header.signature, "EFI PART", 8) != 0
+            || header.header_crc32 != header_crc(header)) {
+        logging::error(std::format("{}: no valid GPT", disk));
+        return 1;
+    }
+    //else
+    const size_t entries_size = (size_t)header.num_partition_entries * header.sizeof_partition_entry;
+    const uint64_t entries_sectors = (entries_size + ss - 1) / ss;
+    std::vector<uint8_t> entries(entries_sectors * ss, 0);
+    if (header.sizeof_partition_entry < sizeof(gpt_entry) || partno < 1 || (uint32_t)partno > header.num_partition_entries
+            || !pread_all(fd, entries.data(), entries.size(), header.partition_entry_lba * ss)
+            || crc32(entries.data(), entries_size) != header.partition_entry_array_crc32) {
+        logging::error(std::format("{}: corrupt GPT partition entries", disk));
+        return 1;
+    }
+    //else
+    auto entry_at = [&](uint32_t i) { return reinterpret_cast<gpt_entry*>(entries.data() + (size_t)i * header.sizeof_partition_entry); };
+    auto entry = entry_at(partno - 1);
+    if (entry->starting_lba * ss != start512 * 512) {
+        logging::error(std::format("{}: GPT entry {} does not match the kernel's view of {}", disk, partno, partition));
+        return 1;
+    }
+    //else
+    for (uint32_t i = 0; i < header.num_partition_entries; i++) {
+        if (entry_at(i)->starting_lba > entry->starting_lba) {
+            logging::warning(std::format("{}: partition {} is not the last one, not growing", disk, partno));
+            return 1;
+        }
+    }
+
+    // backup entries and header occupy the end of the disk
+    const uint64_t backup_header_lba = total - 1;
+    const uint64_t backup_entries_lba = backup_header_lba - entries_sectors;
+    const uint64_t last_usable = backup_entries_lba - 1;
+    const uint64_t align = std::max<uint64_t>(1, ALIGNMENT / ss);
+    const uint64_t new_end = (last_usable + 1) / align * align - 1;
+    if (new_end <= entry->ending_lba) {
+        logging::debug(std::format("{}: already fills the disk", partition));
+        return 0;
+    }
+    //else
+    if (rootfs::dry_run()) {
+        rootfs::record({"grow_partition", partition.string(), std::to_string(entry->ending_lba), std::to_string(new_end)});
+        return resize_filesystem(partition, devnum);
+    }
+    //else
+    const uint64_t old_end = entry->ending_lba;
+    const uint64_t old_backup_lba = header.alternate_lba;
+    entry->ending_lba = new_end;
+
+    header.last_usable_lba = last_usable;
+    header.alternate_lba = backup_header_lba;
+    header.partition_entry_array_crc32 = crc32(entries.data(), entries_size);
+    header.header_crc32 = header_crc(header);
+
+    gpt_header backup = header;
+    backup.my_lba = backup_header_lba;
+    backup.alternate_lba = header.my_lba;
+    backup.partition_entry_lba = backup_entries_lba;
+    backup.header_crc32 = header_crc(backup);
+
+    // backup first, so that a crash in between leaves at least one consistent copy
+    std::vector<uint8_t> sector(ss, 0);
+    memcpy(sector.data(), &backup, sizeof(backup));
+    bool ok = pwrite_all(fd, entries.data(), entries.size(), backup_entries_lba * ss)
+        && pwrite_all(fd, sector.data(), sector.size(), backup_header_lba * ss)
+        && fsync(fd) == 0;
+    memset(sector.data(), 0, sector.size());
+    memcpy(sector.data(), &header, sizeof(header));
+    ok = ok && pwrite_all(fd, entries.data(), entries.size(), header.partition_entry_lba * ss)
+        && pwrite_all(fd, sector.data(), sector.size(), header.my_lba * ss);
+    if (ok && old_backup_lba != backup_header_lba && old_backup_lba < total) {
+        // a stale backup header in the middle of the partition would confuse tools later
+        memset(sector.data(), 0, sector.size());
+        ok = pwrite_all(fd, sector.data(), sector.size(), old_backup_lba * ss);
+    }
+    ok = ok && fsync(fd) == 0;
+    if (!ok) {
+        logging::error(std::format("{}: failed to write GPT: {}", disk, strerror(errno)));
+        return 1;
+    }
+    //else
+    logging::info(std::format("{}: partition {} grown from {} to {} MiB", disk, partno,
+        (old_end - entry->starting_lba + 1) * ss / 1024 / 1024, (new_end - entry->starting_lba + 1) * ss / 1024 / 1024));
+
+    // tell the kernel about the new size without rescanning the whole table (which fails while mounted)
+    struct blkpg_partition part = {};
+    part.start = entry->starting_lba * ss;
+    part.length = (new_end - entry->starting_lba + 1) * ss;
+    part.pno = partno;
+    struct blkpg_ioctl_arg arg = {};
+    arg.op = BLKPG_RESIZE_PARTITION;
+    arg.datalen = sizeof(part);
+    arg.data = &part;
+    if (ioctl(fd, BLKPG, &arg) < 0) {
+        logging::error(std::format("{}: BLKPG_RESIZE_PARTITION failed: {}; the new size takes effect on next boot", disk, strerror(errno)));
+        return 1;
+    }
+    //else
+    return resize_filesystem(partition, devnum);
+}
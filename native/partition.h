@@ -0,0 +1,9 @@
+#pragma once
+#include <filesystem>
+
+// Extends a GPT partition to the end of its disk (1MiB aligned), tells the
+// kernel about the new size with BLKPG and grows the filesystem on it: a
+// mounted filesystem online in the background, an unmounted ext2/3/4 with
+// e2fsck -f -p and resize2fs before returning. Only the last partition on
+// the disk can grow. Returns 0 on success or when there is nothing to do.
+int grow_partition_and_filesystem(const std::filesystem::path& partition);
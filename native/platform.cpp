@@ -1,42 +1,171 @@
 #include <filesystem>
 #include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <limits>
+
+#include <sys/utsname.h>
 
 #include "platform.h"
 #include "filesystem.h"
 #include "logging.h"
+#include "rootfs.h"
 #include "formatter.h"
 
-bool is_raspberry_pi() {
-    std::filesystem::path sys_model("/sys/firmware/devicetree/base/model");
-    if (std::filesystem::exists(sys_model)) {
-        std::ifstream ifs(sys_model);
-        std::string model;
-        std::getline(ifs, model);
-        logging::debug(std::format("Model: '{}'", model));
-        return model.starts_with("Raspberry Pi");
-    } else {
-        logging::debug(std::format("{} not found.", sys_model));
+static std::string read_line(const std::filesystem::path& path)
+{
+    std::ifstream ifs(path);
+    std::string line;
+    if (ifs) std::getline(ifs, line);
+    return line;
+}
+
+static int read_int(const std::filesystem::path& path, int fallback)
+{
+    auto line = read_line(path);
+    try {
+        return line.empty()? fallback : std::stoi(line);
+    }
+    catch (const std::exception&) {
+        return fallback;
     }
-    return false;
 }
 
-bool is_qemu() {
-    std::filesystem::path sys_vendor("/sys/class/dmi/id/sys_vendor");
-    if (std::filesystem::exists(sys_vendor)) {
-        std::ifstream ifs(sys_vendor);
-        std::string vendor;
-        std::getline(ifs, vendor);
-        logging::debug(std::format("Vendor: '{}'", vendor));
-        return vendor == "QEMU";
-    } else {
-        logging::debug(std::format("{} not found.", sys_vendor));
+std::vector<int> parse_cpu_list(const std::string& list)
+{
+    std::vector<int> cpus;
+    std::istringstream iss(list);
+    std::string range;
+    while (std::getline(iss, range, ',')) {
+        if (range.empty()) continue;
+        //else
+        try {
+            auto dash = range.find('-');
+            int first = std::stoi(range.substr(0, dash));
+            int last = dash == std::string::npos? first : std::stoi(range.substr(dash + 1));
+            for (int i = first; i <= last; i++) cpus.push_back(i);
+        }
+        catch (const std::exception&) {
+            logging::warning(std::format("Invalid cpu list '{}'", list));
+            break;
+        }
+    }
+    return cpus;
+}
+
+static void collect_cpuinfo(PlatformInfo& info)
+{
+    std::ifstream ifs(rootfs::path("/proc/cpuinfo"));
+    std::string line;
+    while (std::getline(ifs, line)) {
+        auto colon = line.find(':');
+        if (colon == std::string::npos) continue;
+        //else
+        auto key = line.substr(0, line.find_last_not_of(" \t", colon - 1) + 1);
+        auto value = colon + 2 <= line.size()? line.substr(colon + 2) : std::string();
+        if (key == "model name" && info.cpu_model.empty()) {
+            info.cpu_model = value;
+        } else if ((key == "flags" || key == "Features") && info.cpu_flags.empty()) {
+            std::istringstream iss(value);
+            std::string flag;
+            while (iss >> flag) info.cpu_flags.insert(flag);
+        }
+    }
+}
+
+static void collect_topology(PlatformInfo& info)
+{
+    auto cpu_dir = rootfs::path("/sys/devices/system/cpu");
+    auto online = parse_cpu_list(read_line(cpu_dir / "online"));
+    std::set<std::pair<int, int>> cores;
+    std::set<int> packages;
+    for (auto id: online) {
+        auto topology = cpu_dir / std::format("cpu{}", id) / "topology";
+        PlatformInfo::Cpu cpu {id, read_int(topology / "physical_package_id", 0), read_int(topology / "core_id", id), 0};
+        cores.insert({cpu.package, cpu.core});
+        packages.insert(cpu.package);
+        info.cpus.push_back(cpu);
+    }
+    info.cores = cores.size();
+    info.packages = packages.size();
+    if (info.cores > 0) info.threads_per_core = std::max<int>(1, info.cpus.size() / info.cores);
+
+    auto node_dir = rootfs::path("/sys/devices/system/node");
+    for (auto id: parse_cpu_list(read_line(node_dir / "online"))) {
+        auto node = node_dir / std::format("node{}", id);
+        PlatformInfo::NumaNode numa {id, parse_cpu_list(read_line(node / "cpulist")), 0};
+        // "Node 0 MemTotal:       16318000 kB"
+        std::ifstream ifs(node / "meminfo");
+        std::string line;
+        while (std::getline(ifs, line)) {
+            auto pos = line.find("MemTotal:");
+            if (pos == std::string::npos) continue;
+            //else
+            numa.memory = std::stoull(line.substr(pos + 9)) * 1024;
+            break;
+        }
+        for (auto& cpu: info.cpus) {
+            if (std::find(numa.cpus.begin(), numa.cpus.end(), cpu.id) != numa.cpus.end()) cpu.node = id;
+        }
+        info.numa_nodes.push_back(std::move(numa));
+    }
+}
+
+static PlatformInfo collect_platform_info()
+{
+    PlatformInfo info;
+    struct utsname uts;
+    if (uname(&uts) == 0) info.architecture = uts.machine;
+
+    // devicetree strings are NUL terminated
+    info.model = read_line(rootfs::path("/sys/firmware/devicetree/base/model")).c_str();
+
+    collect_cpuinfo(info);
+    collect_topology(info);
+
+    std::ifstream meminfo(rootfs::path("/proc/meminfo"));
+    std::string key;
+    uint64_t value;
+    while (meminfo >> key >> value) {
+        meminfo.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+        if (key != "MemTotal:") continue;
+        //else
+        info.memory = value * 1024;
+        break;
     }
-    return false;
+
+    auto dmi = rootfs::path("/sys/class/dmi/id");
+    info.dmi.sys_vendor = read_line(dmi / "sys_vendor");
+    info.dmi.product_name = read_line(dmi / "product_name");
+    info.dmi.product_version = read_line(dmi / "product_version");
+    info.dmi.board_vendor = read_line(dmi / "board_vendor");
+    info.dmi.board_name = read_line(dmi / "board_name");
+    info.dmi.bios_vendor = read_line(dmi / "bios_vendor");
+    info.dmi.bios_version = read_line(dmi / "bios_version");
+
+    logging::debug(std::format("Platform: {} '{}' '{}', {} CPUs ({} cores, {} packages, {} NUMA nodes), {} MiB",
+        info.architecture, info.model.empty()? info.dmi.product_name : info.model, info.cpu_model,
+        info.cpus.size(), info.cores, info.packages, info.numa_nodes.size(), info.memory / 1024 / 1024));
+    return info;
+}
+
+const PlatformInfo& get_platform_info()
+{
+    static const PlatformInfo info = collect_platform_info();
+    return info;
+}
+
+bool is_raspberry_pi() {
+    return get_platform_info().model.starts_with("Raspberry Pi");
+}
+
+bool is_qemu() {
+    return get_platform_info().dmi.sys_vendor == "QEMU";
 }
 
 std::optional<std::string> read_qemu_firmware_config(const std::filesystem::path& name)
 {
-    auto path = std::filesystem::path("/sys/firmware/qemu_fw_cfg/by_name") / name / "raw";
+    auto path = rootfs::path("/sys/firmware/qemu_fw_cfg/by_name") / name / "raw";
     if (!std::filesystem::exists(path)) {
         logging::debug(std::format("{} not found.", path));
         return std::nullopt;
@@ -1,5 +1,46 @@
 #include <string>
 #include <optional>
+#include <vector>
+#include <set>
+#include <cstdint>
+
+struct PlatformInfo {
+    struct Cpu {
+        int id;
+        int package;    // physical_package_id
+        int core;       // core_id, unique within the package
+        int node;       // NUMA node, 0 when the kernel has no NUMA support
+    };
+    struct NumaNode {
+        int id;
+        std::vector<int> cpus;
+        uint64_t memory;    // bytes
+    };
+    std::string architecture;   // uname -m
+    std::string model;          // devicetree model, empty on non-DT platforms
+    std::string cpu_model;      // "model name" from /proc/cpuinfo
+    std::set<std::string> cpu_flags;    // "flags" (x86) or "Features" (arm)
+    std::vector<Cpu> cpus;      // online CPUs only
+    int cores = 0;              // distinct (package, core) pairs
+    int packages = 0;
+    int threads_per_core = 1;
+    std::vector<NumaNode> numa_nodes;
+    uint64_t memory = 0;        // MemTotal in bytes
+    struct {
+        std::string sys_vendor;
+        std::string product_name;
+        std::string product_version;
+        std::string board_vendor;
+        std::string board_name;
+        std::string bios_vendor;
+        std::string bios_version;
+    } dmi;                      // empty strings where /sys/class/dmi/id is absent
+};
+
+// Collected on first call and cached for the lifetime of the process
+const PlatformInfo& get_platform_info();
+// parse kernel cpulist format such as "0-3,8,10-11"
+std::vector<int> parse_cpu_list(const std::string& list);
 
 bool is_raspberry_pi();
 bool is_qemu();
@@ -0,0 +1,234 @@
+#include <sys/fanotify.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cstring>
+#include <fstream>
+#include <set>
+#include <sstream>
+#include <thread>
+
+#include "readahead.h"
+#include "logging.h"
+#include "rootfs.h"
+#include "subprocess.h"
+#include "formatter.h"
+
+static const char* recorded_list = "/run/initramfs/rw/genpack-init/readahead.list";
+static const char* shipped_list = "/usr/share/genpack-init/readahead.list";
+static const char* list_header = "# genpack-init readahead v1";
+// Boot rarely reads more than the head of a large file (a database, a
+// firmware blob), and readahead competes with the reads it should speed up
+static const uint64_t max_file_bytes = 16ULL * 1024 * 1024;
+static const uint64_t max_total_bytes = 256ULL * 1024 * 1024;
+
+static std::thread prefetch_thread;
+static std::chrono::steady_clock::time_point prefetch_start;
+// written by the prefetch thread, which must not log
+static std::atomic<size_t> prefetched = 0, missing = 0;
+static std::atomic<uint64_t> prefetched_bytes = 0;
+static size_t listed = 0;
+
+std::string encode_file_list(std::vector<std::string> paths)
+{
+    std::sort(paths.begin(), paths.end());
+    paths.erase(std::unique(paths.begin(), paths.end()), paths.end());
+    std::string data = std::string(list_header) + "\n";
+    std::string prev;
+    for (const auto& path: paths) {
+        size_t common = 0;
+        while (common < prev.size() && common < path.size() && prev[common] == path[common]) common++;
+        data += std::format("{} {}\n", common, path.substr(common));
+        prev = path;
+    }
+    return data;
+}
+
+std::vector<std::string> decode_file_list(const std::string& data)
+{
+    std::vector<std::string> paths;
+    std::istringstream iss(data);
+    std::string line, prev;
+    if (!std::getline(iss, line) || line != list_header) return paths;
+    //else
+    while (std::getline(iss, line)) {
+        auto space = line.find(' ');
+        if (space == std::string::npos) break;
+        //else
+        size_t common;
+        try {
+            common = std::stoul(line.substr(0, space));
+        }
+        catch (const std::exception&) {
+            break;
+        }
+        if (common > prev.size()) break;
+        //else
+        prev = prev.substr(0, common) + line.substr(space + 1);
+        paths.push_back(prev);
+    }
+    return paths;
+}
+
+static void prefetch(std::vector<std::filesystem::path> paths)
+{
+    uint64_t total = 0;
+    for (const auto& path: paths) {
+        if (total >= max_total_bytes) break;
+        //else
+        int fd = open(path.c_str(), O_RDONLY | O_NOATIME | O_CLOEXEC | O_NOFOLLOW);
+        if (fd < 0 && errno == EPERM) fd = open(path.c_str(), O_RDONLY | O_CLOEXEC | O_NOFOLLOW);  // O_NOATIME needs ownership
+        if (fd < 0) {
+            missing++;
+            continue;
+        }
+        //else
+        struct stat st;
+        if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+            auto len = std::min<uint64_t>({(uint64_t)st.st_size, max_file_bytes, max_total_bytes - total});
+            // only queues the I/O; it carries on after init has been exec'ed
+            posix_fadvise(fd, 0, len, POSIX_FADV_WILLNEED);
+            prefetched++;
+            prefetched_bytes += len;
+            total += len;
+        }
+        close(fd);
+    }
+}
+
+bool start_readahead()
+{
+    if (prefetch_thread.joinable()) return true;
+    //else
+    std::ifstream ifs(rootfs::path(recorded_list));
+    if (!ifs) ifs.open(rootfs::path(shipped_list));
+    if (!ifs) {
+        logging::debug("No readahead list");
+        return false;
+    }
+    //else
+    auto paths = decode_file_list(std::string(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>()));
+    std::vector<std::filesystem::path> resolved;
+    for (const auto& path: paths) resolved.push_back(rootfs::path(path));
+    listed = resolved.size();
+    prefetch_start = std::chrono::steady_clock::now();
+    prefetch_thread = std::thread(prefetch, std::move(resolved));
+    logging::debug(std::format("Readahead started for {} files", listed));
+    return true;
+}
+
+void finish_readahead()
+{
+    if (!prefetch_thread.joinable()) return;
+    //else
+    prefetch_thread.join();
+    logging::info(std::format("Readahead: {} of {} files ({} MiB) queued in {}ms, {} missing", prefetched.load(), listed,
+        prefetched_bytes / 1024 / 1024, std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - prefetch_start).count(),
+        missing.load()));
+}
+
+static bool worth_recording(const std::string& path)
+{
+    // /var holds logs, databases and caches: they change between boots and are written more than read
+    for (const char* prefix: {"/proc/", "/sys/", "/dev/", "/run/", "/tmp/", "/var/"}) {
+        if (path.starts_with(prefix)) return false;
+    }
+    return !path.ends_with(" (deleted)");
+}
+
+// runs in the forked recorder; it has no logging and no Python
+[[noreturn]] static void record(int fan, unsigned int seconds)
+{
+    std::set<std::string> paths;
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(seconds);
+    char buf[65536];
+    while (true) {
+        auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+        if (left.count() <= 0) break;
+        //else
+        struct pollfd pfd = { .fd = fan, .events = POLLIN };
+        auto r = poll(&pfd, 1, left.count());
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) break;
+        //else
+        auto len = read(fan, buf, sizeof(buf));
+        if (len < 0 && (errno == EINTR || errno == EAGAIN)) continue;
+        if (len <= 0) break;
+        //else
+        for (auto event = (struct fanotify_event_metadata*)buf; FAN_EVENT_OK(event, len); event = FAN_EVENT_NEXT(event, len)) {
+            if (event->fd < 0) continue;
+            //else
+            struct stat st;
+            char path[PATH_MAX];
+            ssize_t n;
+            if (fstat(event->fd, &st) == 0 && S_ISREG(st.st_mode)
+                    && (n = readlink(std::format("/proc/self/fd/{}", event->fd).c_str(), path, sizeof(path) - 1)) > 0) {
+                std::string p(path, n);
+                if (worth_recording(p)) paths.insert(p);
+            }
+            close(event->fd);
+        }
+    }
+    close(fan);
+
+    std::filesystem::path list = recorded_list;
+    std::error_code ec;
+    std::filesystem::create_directories(list.parent_path(), ec);
+    auto tmp = list;
+    tmp += ".tmp";
+    {
+        std::ofstream ofs(tmp);
+        ofs << encode_file_list(std::vector<std::string>(paths.begin(), paths.end()));
+        if (!ofs.flush()) _exit(1);
+    }
+    std::filesystem::rename(tmp, list, ec);
+    _exit(ec? 1 : 0);
+}
+
+bool start_readahead_recorder(unsigned int seconds)
+{
+    if (rootfs::sandboxed()) return false;
+    //else
+    int fan = fanotify_init(FAN_CLOEXEC | FAN_CLASS_NOTIF | FAN_NONBLOCK, O_RDONLY | O_LARGEFILE | O_CLOEXEC);
+    if (fan < 0) {
+        logging::warning(std::format("readahead: fanotify_init failed: {}", strerror(errno)));
+        return false;
+    }
+    //else
+    // the whole root filesystem if it allows that, otherwise the mounts early boot reads from
+    if (fanotify_mark(fan, FAN_MARK_ADD | FAN_MARK_FILESYSTEM, FAN_OPEN, AT_FDCWD, "/") < 0) {
+        int marked = 0;
+        for (const char* mount: {"/", "/usr"}) {
+            if (fanotify_mark(fan, FAN_MARK_ADD | FAN_MARK_MOUNT, FAN_OPEN, AT_FDCWD, mount) == 0) marked++;
+        }
+        if (marked == 0) {
+            logging::warning(std::format("readahead: fanotify_mark failed: {}", strerror(errno)));
+            close(fan);
+            return false;
+        }
+    }
+    //else
+    auto pid = fork();
+    if (pid < 0) {
+        logging::warning(std::format("readahead: fork failed: {}", strerror(errno)));
+        close(fan);
+        return false;
+    }
+    if (pid == 0) {
+        setsid();
+        signal(SIGTERM, SIG_DFL);
+        record(fan, seconds);
+    }
+    //else
+    close(fan);
+    keep_subprocess(pid);
+    logging::info(std::format("Recording readahead list for {}s (pid {})", seconds, pid));
+    return true;
+}
@@ -0,0 +1,19 @@
+#pragma once
+#include <string>
+#include <vector>
+
+// Boot readahead. The list of files to prefetch is recorded on a previous
+// boot (start_readahead_recorder()) or shipped with the image, and stored
+// sorted and front coded: one "<shared prefix length> <rest>" line per path.
+
+// Prefetches the listed files (posix_fadvise WILLNEED) on a background
+// thread, up to 16 MiB of each and 256 MiB in all. Returns false when there is no list.
+bool start_readahead();
+// Waits for the prefetch thread and logs what it did. Safe to call when it never started.
+void finish_readahead();
+// Forks a process that watches file opens with fanotify for `seconds` (i.e.
+// while init brings up early services) and saves them as the list for the next boot.
+bool start_readahead_recorder(unsigned int seconds = 60);
+
+std::string encode_file_list(std::vector<std::string> paths);
+std::vector<std::string> decode_file_list(const std::string& data);
@@ -0,0 +1,69 @@
+#include <format>
+
+#include "rootfs.h"
+#include "logging.h"
+#include "formatter.h"
+
+static std::filesystem::path root = "/";
+static bool dry_run = false;
+static std::vector<std::vector<std::string>> actions;
+
+std::string rootfs::json_string(const std::string& str)
+{
+    std::string escaped = "\"";
+    for (unsigned char c: str) {
+        switch (c) {
+        case '"': escaped += "\\\""; break;
+        case '\\': escaped += "\\\\"; break;
+        case '\n': escaped += "\\n"; break;
+        case '\t': escaped += "\\t"; break;
+        default:
+            if (c < 0x20) escaped += std::format("\\u{:04x}", c);
+            else escaped += c;
+        }
+    }
+    return escaped + "\"";
+}
+
+namespace rootfs {
+    void set_root(const std::filesystem::path& _root) {
+        ::root = std::filesystem::absolute(_root).lexically_normal();
+    }
+    const std::filesystem::path& root() {
+        return ::root;
+    }
+    std::filesystem::path path(const std::filesystem::path& path) {
+        if (::root == "/" || path.is_relative()) return path;
+        //else
+        auto relative = path.lexically_relative(::root);
+        if (!relative.empty() && *relative.begin() != "..") return path; // already resolved
+        //else
+        return ::root / path.relative_path();
+    }
+    void set_dry_run(bool _dry_run) {
+        ::dry_run = _dry_run;
+    }
+    bool dry_run() {
+        return ::dry_run;
+    }
+    bool sandboxed() {
+        return ::dry_run || ::root != "/";
+    }
+    void record(const std::vector<std::string>& action) {
+        logging::info(std::format("dry-run: {}", action));
+        ::actions.push_back(action);
+    }
+    const std::vector<std::vector<std::string>>& actions() {
+        return ::actions;
+    }
+    void write_actions(std::ostream& os) {
+        for (const auto& action: ::actions) {
+            os << "[";
+            for (size_t i = 0; i < action.size(); i++) {
+                if (i > 0) os << ", ";
+                os << rootfs::json_string(action[i]);
+            }
+            os << "]" << std::endl;
+        }
+    }
+}
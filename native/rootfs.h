@@ -0,0 +1,24 @@
+#pragma once
+#include <filesystem>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Where the system being configured lives. Normally "/", but genpack-init can
+// be pointed at an unpacked image (--root) and told to only record the
+// actions that would change it (--dry-run).
+namespace rootfs {
+    void set_root(const std::filesystem::path& root);
+    const std::filesystem::path& root();
+    // Resolves an absolute path of the target system. Paths already under root are returned as is.
+    std::filesystem::path path(const std::filesystem::path& path);
+    void set_dry_run(bool dry_run);
+    bool dry_run();
+    bool sandboxed();
+    void record(const std::vector<std::string>& action);
+    const std::vector<std::vector<std::string>>& actions();
+    // one JSON array per line
+    void write_actions(std::ostream& os);
+    // quoted and escaped JSON string
+    std::string json_string(const std::string& str);
+}
@@ -1,30 +1,118 @@
 #include <unistd.h>
+#include <signal.h>
 #include <sys/wait.h>
 
+#include <mutex>
+#include <set>
+#include <fstream>
+#include <filesystem>
+
 #include "subprocess.h"
 #include "logging.h"
+#include "rootfs.h"
 #include "formatter.h"
 
+static std::mutex children_mutex;
+static std::set<pid_t> children;  // running run_subprocess() children, each leading its own process group
+static std::set<pid_t> kept;      // long-lived helpers kill_subprocesses() must spare
+
 int run_subprocess(std::vector<std::string> cmdline)
 {
+    if (rootfs::dry_run()) {
+        rootfs::record(cmdline);
+        return 0;
+    }
+    //else
     logging::debug(std::format("Running command: {}", cmdline));
+    // build argv before fork(); other threads may hold the allocator lock
+    std::vector<char*> argv;
+    for (const auto& arg: cmdline) {
+        argv.push_back(const_cast<char*>(arg.c_str()));
+    }
+    argv.push_back(nullptr);
     auto pid = fork();
     if (pid == -1) {
         return -1;
     }
     if (pid == 0) {
-        std::vector<char*> argv;
-        for (const auto& arg: cmdline) {
-            argv.push_back(const_cast<char*>(arg.c_str()));
-        }
-        argv.push_back(nullptr);
+        // own process group, so that a watchdog can kill the whole tree
+        setpgid(0, 0);
         execvp(argv[0], argv.data());
         _exit(1);
     }
     //else
-    int status;
-    waitpid(pid, &status, 0);
+    setpgid(pid, pid);
+    {
+        std::lock_guard lock(children_mutex);
+        children.insert(pid);
+    }
+    int status = 0;
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {
+        // interrupted by a signal (e.g. a time budget running out); keep waiting
+    }
+    {
+        std::lock_guard lock(children_mutex);
+        children.erase(pid);
+    }
     auto rst = WIFEXITED(status)? WEXITSTATUS(status) : -1;
     logging::debug(std::format("Command exited with status: {}", rst));
     return rst;
-}
\ No newline at end of file
+}
+
+pid_t spawn_subprocess(std::vector<std::string> cmdline)
+{
+    if (rootfs::dry_run()) {
+        rootfs::record(cmdline);
+        return 0;
+    }
+    //else
+    logging::debug(std::format("Starting command: {}", cmdline));
+    std::vector<char*> argv;
+    for (const auto& arg: cmdline) {
+        argv.push_back(const_cast<char*>(arg.c_str()));
+    }
+    argv.push_back(nullptr);
+    auto pid = fork();
+    if (pid == -1) {
+        return -1;
+    }
+    if (pid == 0) {
+        setsid();
+        execvp(argv[0], argv.data());
+        _exit(1);
+    }
+    //else
+    keep_subprocess(pid);
+    return pid;
+}
+
+void keep_subprocess(pid_t pid)
+{
+    std::lock_guard lock(children_mutex);
+    kept.insert(pid);
+}
+
+void kill_subprocesses()
+{
+    std::set<pid_t> groups, spare;
+    {
+        std::lock_guard lock(children_mutex);
+        groups = children;
+        spare = kept;
+    }
+    for (auto pgid: groups) {
+        kill(-pgid, SIGKILL);
+    }
+    // children forked by other means, e.g. Python's subprocess module.
+    // Runs on the watchdog thread: nothing here may throw.
+    std::error_code ec;
+    for (auto it = std::filesystem::directory_iterator("/proc/self/task", ec); !ec && it != std::filesystem::directory_iterator(); it.increment(ec)) {
+        std::ifstream ifs(it->path() / "children");
+        pid_t pid;
+        while (ifs >> pid) {
+            if (groups.contains(pid) || spare.contains(pid)) continue;
+            //else
+            kill(getpgid(pid) == pid? -pid : pid, SIGKILL);
+        }
+    }
+}
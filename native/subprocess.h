@@ -1,4 +1,11 @@
+#include <sys/types.h>
 #include <vector>
 #include <string>
 
 int run_subprocess(std::vector<std::string> cmdline);
+// Starts cmdline in its own session without waiting for it. It outlives genpack-init
+// (init inherits and reaps it) and is spared by kill_subprocesses(). Returns the pid, or -1.
+pid_t spawn_subprocess(std::vector<std::string> cmdline);
+// SIGKILLs every child process (with its process group when it leads one) except those passed to keep_subprocess()
+void kill_subprocesses();
+void keep_subprocess(pid_t pid);
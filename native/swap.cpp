@@ -0,0 +1,260 @@
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/swap.h>
+#include <sys/random.h>
+#include <linux/fs.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <blkid/blkid.h>
+
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <vector>
+
+#include "swap.h"
+#include "platform.h"
+#include "logging.h"
+#include "rootfs.h"
+#include "subprocess.h"
+#include "formatter.h"
+
+// include/linux/swap.h
+struct swap_header_v1 {
+    char bootbits[1024];
+    uint32_t version;
+    uint32_t last_page;
+    uint32_t nr_badpages;
+    unsigned char uuid[16];
+    char volume_name[16];
+    uint32_t padding[117];
+    uint32_t badpages[1];
+};
+
+static const char SWAP_SIGNATURE[] = "SWAPSPACE2";
+
+// Erases every filesystem, RAID and partition table signature blkid knows of
+// (e.g. btrfs at 64KiB and its backup superblocks), as mkswap does, so nothing
+// probes the device as its old contents afterwards.
+static void wipe_signatures(int fd, const std::filesystem::path& device)
+{
+    auto _probe = blkid_new_probe();
+    if (!_probe) return;
+    //else
+    std::shared_ptr<blkid_struct_probe> probe(_probe, blkid_free_probe);
+    if (blkid_probe_set_device(probe.get(), fd, 0, 0) != 0) return;
+    //else
+    blkid_probe_enable_superblocks(probe.get(), 1);
+    blkid_probe_set_superblocks_flags(probe.get(), BLKID_SUBLKS_MAGIC | BLKID_SUBLKS_TYPE | BLKID_SUBLKS_BADCSUM);
+    blkid_probe_enable_partitions(probe.get(), 1);
+    blkid_probe_set_partitions_flags(probe.get(), BLKID_PARTS_MAGIC);
+    while (blkid_do_probe(probe.get()) == 0) {
+        const char* type = nullptr;
+        if (blkid_probe_lookup_value(probe.get(), "TYPE", &type, nullptr) != 0) {
+            blkid_probe_lookup_value(probe.get(), "PTTYPE", &type, nullptr);
+        }
+        logging::info(std::format("{}: wiping old {} signature", device, type? type : "unknown"));
+        if (blkid_do_wipe(probe.get(), 0) != 0) {
+            logging::warning(std::format("{}: failed to wipe {} signature", device, type? type : "unknown"));
+            break;
+        }
+    }
+}
+
+int write_swap_header(const std::filesystem::path& _device, const std::optional<std::string>& label)
+{
+    if (rootfs::dry_run()) {
+        std::vector<std::string> action = {"mkswap"};
+        if (label) action.insert(action.end(), {"-L", *label});
+        action.push_back(_device.string());
+        rootfs::record(action);
+        return 0;
+    }
+    //else
+    auto device = rootfs::path(_device);
+    struct stat st;
+    if (stat(device.c_str(), &st) < 0) {
+        logging::error(std::format("stat({}) failed: {}", device, strerror(errno)));
+        return 1;
+    }
+    //else
+    // O_EXCL on a block device fails with EBUSY while it is mounted, in use as swap or held by dm/md
+    bool blockdev = S_ISBLK(st.st_mode);
+    int fd = open(device.c_str(), O_RDWR | O_CLOEXEC | (blockdev? O_EXCL : 0));
+    if (fd < 0) {
+        if (errno == EBUSY) logging::error(std::format("{} is in use, refusing to format it as swap", device));
+        else logging::error(std::format("open({}) failed: {}", device, strerror(errno)));
+        return 1;
+    }
+    //else
+    uint64_t size = 0;
+    if (blockdev) {
+        if (ioctl(fd, BLKGETSIZE64, &size) < 0) size = 0;
+    } else if (fstat(fd, &st) == 0) {
+        size = st.st_size;
+    }
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    uint64_t pages = size / page_size;
+    if (pages < 10) {
+        logging::error(std::format("{}: too small for swap ({} bytes)", device, size));
+        close(fd);
+        return 1;
+    }
+    //else
+    wipe_signatures(fd, device);
+    std::vector<char> page(page_size, 0);
+    auto header = reinterpret_cast<swap_header_v1*>(page.data());
+    header->version = 1;
+    header->last_page = std::min<uint64_t>(pages - 1, UINT32_MAX);
+    header->nr_badpages = 0;
+    if (getrandom(header->uuid, sizeof(header->uuid), 0) != sizeof(header->uuid)) {
+        logging::warning(std::format("{}: getrandom failed, swap UUID will be zero", device));
+        memset(header->uuid, 0, sizeof(header->uuid));
+    } else {
+        header->uuid[6] = (header->uuid[6] & 0x0f) | 0x40;  // version 4
+        header->uuid[8] = (header->uuid[8] & 0x3f) | 0x80;  // RFC 4122 variant
+    }
+    if (label) strncpy(header->volume_name, label->c_str(), sizeof(header->volume_name));
+    memcpy(page.data() + page_size - (sizeof(SWAP_SIGNATURE) - 1), SWAP_SIGNATURE, sizeof(SWAP_SIGNATURE) - 1);
+
+    auto written = pwrite(fd, page.data(), page.size(), 0);
+    auto saved_errno = errno;
+    if (written == (ssize_t)page.size() && fsync(fd) < 0) saved_errno = errno, written = -1;
+    close(fd);
+    if (written != (ssize_t)page.size()) {
+        logging::error(std::format("{}: failed to write swap header: {}", device, strerror(saved_errno)));
+        return 1;
+    }
+    //else
+    logging::info(std::format("Swap space created on {} ({} MiB)", device, pages * page_size / 1024 / 1024));
+    return 0;
+}
+
+int activate_swap(const std::filesystem::path& device, int priority, bool discard)
+{
+    int flags = 0;
+    if (priority >= 0) flags |= SWAP_FLAG_PREFER | ((priority << SWAP_FLAG_PRIO_SHIFT) & SWAP_FLAG_PRIO_MASK);
+    if (discard) flags |= SWAP_FLAG_DISCARD;
+    if (rootfs::dry_run()) {
+        std::vector<std::string> action = {"swapon"};
+        if (priority >= 0) action.insert(action.end(), {"-p", std::to_string(priority)});
+        if (discard) action.push_back("--discard");
+        action.push_back(device.string());
+        rootfs::record(action);
+        return 0;
+    }
+    //else
+    if (swapon(rootfs::path(device).c_str(), flags) < 0) {
+        logging::error(std::format("swapon({}) failed: {}", device, strerror(errno)));
+        return 1;
+    }
+    //else
+    logging::info(std::format("Swap enabled on {} (priority {})", device, priority));
+    return 0;
+}
+
+static bool write_sysfs(const std::filesystem::path& path, const std::string& value)
+{
+    if (rootfs::dry_run()) {
+        rootfs::record({"write", path.string(), value});
+        return true;
+    }
+    //else
+    std::ofstream ofs(path);
+    ofs << value << std::flush;
+    if (!ofs) {
+        logging::error(std::format("Failed to write '{}' to {}", value, path));
+        return false;
+    }
+    //else
+    logging::debug(std::format("{} = {}", path, value));
+    return true;
+}
+
+static std::string read_sysfs(const std::filesystem::path& path)
+{
+    std::ifstream ifs(path);
+    std::string value;
+    if (ifs) std::getline(ifs, value);
+    return value;
+}
+
+// An unused zram device (disksize 0), adding one if there is none
+static std::optional<std::string> find_free_zram()
+{
+    auto sys_block = rootfs::path("/sys/block");
+    if (!std::filesystem::exists(rootfs::path("/sys/class/zram-control"))) {
+        run_subprocess({"modprobe", "zram"});
+    }
+    int i = 0;
+    for (; std::filesystem::exists(sys_block / std::format("zram{}", i)); i++) {
+        if (read_sysfs(sys_block / std::format("zram{}", i) / "disksize") == "0") return std::format("zram{}", i);
+    }
+    //else
+    auto hot_add = rootfs::path("/sys/class/zram-control/hot_add");
+    if (rootfs::dry_run()) {
+        // reading hot_add would add a device; go on with the name it would most likely get
+        rootfs::record({"read", hot_add.string()});
+        return std::format("zram{}", i);
+    }
+    //else
+    if (!std::filesystem::exists(hot_add)) {
+        logging::warning("zram is not available");
+        return std::nullopt;
+    }
+    //else
+    auto id = read_sysfs(hot_add);   // reading it adds a device
+    if (id.empty()) {
+        logging::error("Failed to add a zram device");
+        return std::nullopt;
+    }
+    //else
+    return "zram" + id;
+}
+
+std::optional<std::filesystem::path> setup_zram_swap(const ZramConfig& config)
+{
+    const auto& platform = get_platform_info();
+    auto name = find_free_zram();
+    if (!name) return std::nullopt;
+    //else
+    auto sys = rootfs::path("/sys/block") / *name;
+
+    // everything below has to be set before disksize
+    if (config.algorithm) {
+        auto available = " " + read_sysfs(sys / "comp_algorithm") + " ";
+        if (available.find(" " + *config.algorithm + " ") == std::string::npos
+                && available.find(" [" + *config.algorithm + "] ") == std::string::npos) {
+            logging::warning(std::format("{}: compression algorithm {} not available ({})", *name, *config.algorithm, available));
+        } else if (!write_sysfs(sys / "comp_algorithm", *config.algorithm)) return std::nullopt;
+    }
+    // a no-op on kernels that always use per-CPU streams, but older ones default to one
+    if (std::filesystem::exists(sys / "max_comp_streams")) {
+        write_sysfs(sys / "max_comp_streams", std::to_string(std::max<size_t>(1, platform.cpus.size())));
+    }
+    if (config.writeback_device) {
+        if (!std::filesystem::exists(sys / "backing_dev")) {
+            logging::warning(std::format("{}: kernel lacks CONFIG_ZRAM_WRITEBACK, ignoring {}", *name, config.writeback_device->string()));
+        } else if (!write_sysfs(sys / "backing_dev", config.writeback_device->string())) return std::nullopt;
+    }
+
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    uint64_t size = platform.memory * config.memory_fraction;
+    if (config.max_size) size = std::min(size, *config.max_size);
+    size = size / page_size * page_size;
+    if (size == 0) {
+        logging::error(std::format("{}: computed size is zero (memory {} bytes)", *name, platform.memory));
+        return std::nullopt;
+    }
+    //else
+    if (!write_sysfs(sys / "disksize", std::to_string(size))) return std::nullopt;
+    //else
+    std::filesystem::path device = "/dev/" + *name;
+    if (write_swap_header(device, "zram") != 0) return std::nullopt;
+    //else
+    if (activate_swap(device, config.priority, true) != 0) return std::nullopt;
+    //else
+    logging::info(std::format("zram swap {}: {} MiB, {} streams{}", device, size / 1024 / 1024, platform.cpus.size(),
+        config.writeback_device? ", writeback to " + config.writeback_device->string() : ""));
+    return device;
+}
@@ -0,0 +1,22 @@
+#pragma once
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <cstdint>
+
+struct ZramConfig {
+    std::optional<std::string> algorithm;   // kernel default (lzo-rle) if not given
+    double memory_fraction = 0.5;           // of MemTotal
+    std::optional<uint64_t> max_size;       // bytes
+    std::optional<std::filesystem::path> writeback_device;  // backing_dev for incompressible/idle pages
+    int priority = 100;                     // above any disk swap
+};
+
+// Writes a version 1 swap header (what mkswap does) without forking, after wiping old
+// signatures. Refuses block devices that are in use. Returns 0 on success.
+int write_swap_header(const std::filesystem::path& device, const std::optional<std::string>& label = std::nullopt);
+// swapon(2). priority < 0 leaves it to the kernel. Returns 0 on success.
+int activate_swap(const std::filesystem::path& device, int priority = -1, bool discard = false);
+// Sets up a zram device sized from total memory, formats it as swap and activates it.
+// Returns the device path, or nullopt when zram is unavailable or setup failed.
+std::optional<std::filesystem::path> setup_zram_swap(const ZramConfig& config = {});
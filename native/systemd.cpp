@@ -3,10 +3,22 @@
 #include "subprocess.h"
 #include "filesystem.h"
 #include "logging.h"
+#include "rootfs.h"
+
+static std::vector<std::string> systemctl(const std::string& verb, const std::string& name)
+{
+    std::vector<std::string> cmdline = {"systemctl"};
+    if (rootfs::root() != "/") {
+        cmdline.push_back("--root=" + rootfs::root().string());
+    }
+    cmdline.push_back(verb);
+    cmdline.push_back(name);
+    return cmdline;
+}
 
 int enable_systemd_service(const std::string& name)
 {
-    int rst = run_subprocess({"systemctl", "enable", name});
+    int rst = run_subprocess(systemctl("enable", name));
     if (rst == 0) {
         logging::info(std::format("Systemd service {} enabled.", name));
     } else {   
@@ -17,7 +29,7 @@ int enable_systemd_service(const std::string& name)
 
 int disable_systemd_service(const std::string& name)
 {
-    int rst = run_subprocess({"systemctl", "disable", name});
+    int rst = run_subprocess(systemctl("disable", name));
     if (rst == 0) {
         logging::info(std::format("Systemd service {} disabled.", name));
     } else {   
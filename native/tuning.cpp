@@ -0,0 +1,221 @@
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <algorithm>
+#include <map>
+#include <charconv>
+#include <cstdint>
+
+#include "tuning.h"
+#include "platform.h"
+#include "logging.h"
+#include "rootfs.h"
+#include "formatter.h"
+
+static std::string read_value(const std::filesystem::path& path)
+{
+    std::ifstream ifs(path);
+    std::string value;
+    if (ifs) std::getline(ifs, value);
+    return value;
+}
+
+static std::optional<int> parse_int(const std::string& str)
+{
+    int value;
+    auto [ptr, ec] = std::from_chars(str.data(), str.data() + str.size(), value);
+    if (ec != std::errc() || ptr != str.data() + str.size()) return std::nullopt;
+    //else
+    return value;
+}
+
+// Writes value unless it is already in effect. Returns false on failure.
+// A write refused with ignored_errno is only logged at debug level.
+static bool write_value(const std::filesystem::path& path, const std::string& value, const std::string& what, int ignored_errno = 0)
+{
+    auto current = read_value(path);
+    if (current == value) {
+        logging::debug(std::format("{}: already {}", what, value));
+        return true;
+    }
+    //else
+    if (rootfs::dry_run()) {
+        rootfs::record({"write", path.string(), value});
+        return true;
+    }
+    //else
+    int fd = open(path.c_str(), O_WRONLY | O_CLOEXEC);
+    bool ok = fd >= 0 && write(fd, value.data(), value.size()) == (ssize_t)value.size();
+    int err = errno;
+    if (fd >= 0) close(fd);
+    if (!ok && ignored_errno != 0 && err == ignored_errno) {
+        logging::debug(std::format("{}: refused {} ({}), kept '{}'", what, value, strerror(err), current));
+        return true;
+    }
+    if (!ok) {
+        logging::warning(std::format("{}: failed to set {} (kept '{}'): {}", what, value, current, strerror(err)));
+        return false;
+    }
+    //else
+    logging::info(std::format("{}: {} -> {}", what, current, value));
+    return true;
+}
+
+std::string cpu_mask(const std::vector<int>& cpus)
+{
+    if (cpus.empty()) return "0";
+    //else
+    auto max_cpu = *std::max_element(cpus.begin(), cpus.end());
+    std::vector<uint32_t> words(max_cpu / 32 + 1, 0);
+    for (auto cpu: cpus) words[cpu / 32] |= 1u << (cpu % 32);
+    std::string mask;
+    for (auto it = words.rbegin(); it != words.rend(); it++) {
+        mask += mask.empty()? std::format("{:x}", *it) : std::format(",{:08x}", *it);
+    }
+    return mask;
+}
+
+static int apply_sysctl(const std::vector<std::pair<std::string, std::string>>& sysctl)
+{
+    int failed = 0;
+    auto proc_sys = rootfs::path("/proc/sys");
+    for (const auto& [key, value]: sysctl) {
+        // an image has no /proc/sys to check the key against
+        if (rootfs::dry_run()) {
+            rootfs::record({"sysctl", "-w", key + "=" + value});
+            continue;
+        }
+        //else
+        // like sysctl.d(5): dots are separators unless the key already uses slashes
+        auto rel = key;
+        if (rel.find('/') == std::string::npos) std::replace(rel.begin(), rel.end(), '.', '/');
+        auto path = proc_sys / rel;
+        std::error_code ec;
+        if (!std::filesystem::exists(path, ec)) {
+            logging::warning(std::format("sysctl {}: no such key", key));
+            failed++;
+            continue;
+        }
+        //else
+        if (!write_value(path, value, "sysctl " + key)) failed++;
+    }
+    return failed;
+}
+
+static int apply_governor(const std::string& governor)
+{
+    int failed = 0;
+    auto cpu_dir = rootfs::path("/sys/devices/system/cpu");
+    std::error_code ec;
+    for (const auto& cpu: get_platform_info().cpus) {
+        auto cpufreq = cpu_dir / std::format("cpu{}", cpu.id) / "cpufreq";
+        if (!std::filesystem::exists(cpufreq / "scaling_governor", ec)) continue;
+        //else
+        auto available = " " + read_value(cpufreq / "scaling_available_governors") + " ";
+        if (available.find(" " + governor + " ") == std::string::npos) {
+            logging::warning(std::format("cpu{}: governor {} not available (available:{})", cpu.id, governor, available));
+            failed++;
+            continue;
+        }
+        //else
+        if (!write_value(cpufreq / "scaling_governor", governor, std::format("cpu{} governor", cpu.id))) failed++;
+    }
+    return failed;
+}
+
+// CPUs local to a device's NUMA node. All online CPUs when the device has no
+// affinity (numa_node = -1) or the node has no CPUs.
+static std::vector<int> local_cpus(const std::filesystem::path& device)
+{
+    const auto& info = get_platform_info();
+    auto node = parse_int(read_value(device / "numa_node")).value_or(-1);
+    for (const auto& numa: info.numa_nodes) {
+        if (numa.id == node && !numa.cpus.empty()) return numa.cpus;
+    }
+    //else
+    std::vector<int> cpus;
+    for (const auto& cpu: info.cpus) cpus.push_back(cpu.id);
+    return cpus;
+}
+
+static int apply_irq_affinity()
+{
+    int failed = 0;
+    auto pci_devices = rootfs::path("/sys/bus/pci/devices");
+    auto proc_irq = rootfs::path("/proc/irq");
+    std::map<std::vector<int>, size_t> next; // round-robin position per CPU set
+    std::vector<std::filesystem::path> devices;
+    std::error_code ec;
+    for (const auto& entry: std::filesystem::directory_iterator(pci_devices, ec)) devices.push_back(entry.path());
+    std::sort(devices.begin(), devices.end());
+    for (const auto& device: devices) {
+        std::vector<int> irqs;
+        if (std::filesystem::is_directory(device / "msi_irqs", ec)) {
+            for (const auto& entry: std::filesystem::directory_iterator(device / "msi_irqs", ec)) {
+                if (auto irq = parse_int(entry.path().filename().string())) irqs.push_back(*irq);
+            }
+            std::sort(irqs.begin(), irqs.end());
+        } else {
+            auto irq = parse_int(read_value(device / "irq"));
+            if (irq && *irq != 0) irqs.push_back(*irq);
+        }
+        if (irqs.empty()) continue;
+        //else
+        auto cpus = local_cpus(device);
+        if (cpus.empty()) continue;
+        //else
+        auto& pos = next[cpus];
+        for (auto irq: irqs) {
+            auto affinity = proc_irq / std::to_string(irq) / "smp_affinity_list";
+            if (!std::filesystem::exists(affinity, ec)) continue;
+            //else
+            auto cpu = cpus[pos++ % cpus.size()];
+            // managed interrupts (e.g. NVMe queues) are spread by the kernel and refuse writes with EIO
+            if (!write_value(affinity, std::to_string(cpu), std::format("{} irq {}", device.filename(), irq), EIO)) failed++;
+        }
+    }
+    return failed;
+}
+
+static int apply_packet_steering(bool rps, bool xps)
+{
+    int failed = 0;
+    auto net = rootfs::path("/sys/class/net");
+    std::error_code ec;
+    for (const auto& entry: std::filesystem::directory_iterator(net, ec)) {
+        auto iface = entry.path();
+        // virtual interfaces have no device and nothing to steer
+        if (!std::filesystem::exists(iface / "device", ec)) continue;
+        //else
+        auto cpus = local_cpus(iface / "device");
+        if (cpus.empty()) continue;
+        //else
+        // not every driver exposes queues/
+        std::vector<std::filesystem::path> queues;
+        for (const auto& queue: std::filesystem::directory_iterator(iface / "queues", ec)) queues.push_back(queue.path());
+        std::sort(queues.begin(), queues.end());
+        size_t tx = 0;
+        for (const auto& queue: queues) {
+            auto name = queue.filename().string();
+            auto what = std::format("{} {}", iface.filename(), name);
+            if (rps && name.starts_with("rx-") && std::filesystem::exists(queue / "rps_cpus", ec)) {
+                if (!write_value(queue / "rps_cpus", cpu_mask(cpus), what + " rps_cpus")) failed++;
+            } else if (xps && name.starts_with("tx-") && std::filesystem::exists(queue / "xps_cpus", ec)) {
+                if (!write_value(queue / "xps_cpus", cpu_mask({cpus[tx++ % cpus.size()]}), what + " xps_cpus")) failed++;
+            }
+        }
+    }
+    return failed;
+}
+
+int apply_tuning(const TuningProfile& profile)
+{
+    int failed = apply_sysctl(profile.sysctl);
+    if (profile.governor) failed += apply_governor(*profile.governor);
+    if (profile.irq_affinity) failed += apply_irq_affinity();
+    if (profile.rps || profile.xps) failed += apply_packet_steering(profile.rps, profile.xps);
+    return failed;
+}
@@ -0,0 +1,21 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <optional>
+#include <utility>
+
+// Declarative performance tuning, normally read from [sysctl] and [tuning]
+// in system.ini. Applied once, before init starts any service.
+struct TuningProfile {
+    // in file order; "vm.swappiness" or "net/ipv4/conf/eth0.100/forwarding"
+    std::vector<std::pair<std::string, std::string>> sysctl;
+    std::optional<std::string> governor;
+    bool irq_affinity = false;  // pin PCI device IRQs to CPUs of the device's NUMA node
+    bool rps = false;           // steer received packets to node-local CPUs
+    bool xps = false;           // map each tx queue to one node-local CPU
+};
+
+// Returns the number of settings that could not be applied
+int apply_tuning(const TuningProfile& profile);
+// comma separated 32-bit hex words as used by rps_cpus, xps_cpus and smp_affinity
+std::string cpu_mask(const std::vector<int>& cpus);
@@ -0,0 +1,79 @@
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <map>
+
+#include "watchdog.h"
+
+struct Timer {
+    std::chrono::steady_clock::time_point deadline;
+    std::function<void()> on_expire;
+};
+
+// Never destroyed: the detached thread still waits on them while the process exits
+static std::mutex& mutex = *new std::mutex;
+static std::condition_variable& cv = *new std::condition_variable;
+static std::map<uint64_t, Timer>& timers = *new std::map<uint64_t, Timer>;
+static uint64_t next_id = 1;
+static uint64_t running_id = 0;
+static std::thread::id thread_id;
+static std::atomic<bool> interrupted_flag = false;
+
+static void run()
+{
+    std::unique_lock lock(mutex);
+    while (true) {
+        if (timers.empty()) {
+            cv.wait(lock);
+            continue;
+        }
+        //else
+        auto next = timers.begin();
+        for (auto it = timers.begin(); it != timers.end(); it++) {
+            if (it->second.deadline < next->second.deadline) next = it;
+        }
+        if (std::chrono::steady_clock::now() < next->second.deadline) {
+            cv.wait_until(lock, next->second.deadline);
+            continue;
+        }
+        //else
+        auto on_expire = std::move(next->second.on_expire);
+        running_id = next->first;
+        timers.erase(next);
+        lock.unlock();
+        on_expire();
+        lock.lock();
+        running_id = 0;
+        cv.notify_all();
+    }
+}
+
+namespace watchdog {
+    uint64_t arm(std::chrono::milliseconds timeout, std::function<void()> on_expire) {
+        std::lock_guard lock(mutex);
+        if (thread_id == std::thread::id()) {
+            std::thread thread(run);
+            thread_id = thread.get_id();
+            thread.detach();
+        }
+        auto id = next_id++;
+        timers[id] = { std::chrono::steady_clock::now() + timeout, std::move(on_expire) };
+        cv.notify_all();
+        return id;
+    }
+    void disarm(uint64_t id) {
+        std::unique_lock lock(mutex);
+        timers.erase(id);
+        if (std::this_thread::get_id() == thread_id) return; // called from a callback
+        //else
+        cv.wait(lock, [id]() { return running_id != id; });
+        cv.notify_all();
+    }
+    void set_interrupted(bool interrupted) {
+        interrupted_flag = interrupted;
+    }
+    bool interrupted() {
+        return interrupted_flag;
+    }
+}
@@ -0,0 +1,16 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <functional>
+
+// One background thread running timers. Callbacks run on that thread, so they
+// must not call back into Python (and therefore not into logging::).
+namespace watchdog {
+    uint64_t arm(std::chrono::milliseconds timeout, std::function<void()> on_expire);
+    // Cancels a timer. If its callback is running right now, waits for it to return.
+    void disarm(uint64_t id);
+    // Set while a time budget has run out. Native loops that retry on EINTR
+    // check it so that they give up instead of outliving the budget.
+    void set_interrupted(bool interrupted);
+    bool interrupted();
+}
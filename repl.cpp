@@ -4,9 +4,10 @@ int repl()
 {
     pybind11::exec(R"(
 import code,readline,rlcompleter
-from genpack_init import get_block_device_info, get_partition_info, parted, mkfs, mkswap
-from genpack_init import boot_path, root_path, ro_path, rw_path, chown, chmod
-from genpack_init import is_raspberry_pi, is_qemu, read_qemu_firmware_config
+from genpack_init import get_block_device_info, get_partition_info, wait_for_device, wait_for_devices, parted, grow_partition_and_filesystem, mkfs, mkswap, swapon, setup_zram_swap
+from genpack_init import boot_path, root_path, ro_path, rw_path, chown, chmod, copy_tree, provision_accounts
+from genpack_init import get_platform_info, is_raspberry_pi, is_qemu, read_qemu_firmware_config
+from genpack_init import configure_network, wait_for_carrier
 from genpack_init import enable_systemd_service, disable_systemd_service
 history_file = os.path.expanduser("~/.genpack_init_history")
 if os.path.exists(history_file):